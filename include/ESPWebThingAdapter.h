@@ -23,6 +23,10 @@
 #include <ESPmDNS.h>
 #endif
 #include "Thing.h"
+#include "ThingActionExecutor.h"
+#include "ThingConnection.h"
+#include "ThingJournal.h"
+#include "ThingRouter.h"
 
 #define ESP_MAX_PUT_BODY_SIZE 512
 
@@ -42,20 +46,117 @@
 #endif
 #endif
 
-String test_TD;
-int TD_len;
+// TDs up to this size are published whole on things/<id>, larger ones in
+// THING_CHUNK_SIZE parts, see ThingMQTTAdapter::publishDescription(); more
+// than one chunk is always published in parts
+#ifndef THING_TD_INLINE_LIMIT
+#define THING_TD_INLINE_LIMIT THING_CHUNK_SIZE
+#endif
+
+// default size of the adapter's device table
+#ifndef THING_MAX_DEVICES
+#define THING_MAX_DEVICES 16
+#endif
+
+// requests from the broker waiting for update(), see
+// ThingMQTTAdapter::handleMessage()
+#ifndef THING_INBOX_SLOTS
+#define THING_INBOX_SLOTS 4
+#endif
+
+#ifndef THING_INBOX_PAYLOAD_SIZE
+#define THING_INBOX_PAYLOAD_SIZE 256
+#endif
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+static bool journal_append(const char *topic, const char *payload, size_t len);
+static void journal_delivered(const char *topic, const char *payload, size_t len);
+class ThingMQTTAdapter;
+extern ThingMQTTAdapter *mqttAdapter;
+
+/**
+ * Publishes what is written as numbered parts of THING_CHUNK_SIZE bytes,
+ * on <prefix><n><suffix>, through one buffer, so a large answer never
+ * has to be held whole; see ThingMQTTAdapter::publishHistory().
+ */
+class ThingMQTTPartPrint : public Print
+{
+public:
+  ThingMQTTPartPrint(const String &prefix_, const char *suffix_, int qos_)
+      : prefix(prefix_), suffix(suffix_), qos(qos_) {}
+
+  size_t write(uint8_t c) override
+  {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t *data, size_t size) override
+  {
+    for (size_t done = 0; done < size;)
+    {
+      size_t n = size - done < sizeof(buffer) - len ? size - done : sizeof(buffer) - len;
+      memcpy(buffer + len, data + done, n);
+      len += n;
+      done += n;
+      if (len == sizeof(buffer))
+      {
+        publishPart();
+      }
+    }
+    return size;
+  }
+
+  // publishes the last, partly filled part
+  void end()
+  {
+    if (len > 0)
+    {
+      publishPart();
+    }
+  }
+
+  size_t partCount() const { return parts; }
+
+private:
+  String prefix;
+  const char *suffix;
+  int qos;
+  char buffer[THING_CHUNK_SIZE];
+  size_t len = 0;
+  size_t parts = 0;
+
+  void publishPart()
+  {
+    String topic = prefix + parts + suffix;
+    thing_mqtt_publish(topic.c_str(), buffer, len, qos, false);
+    parts++;
+    len = 0;
+  }
+};
 
 class ThingMQTTAdapter
 {
 public:
-  ThingMQTTAdapter(String _name, String mqttbroker_Address_)
-      : name(_name)
+  /**
+   * maxDevices sizes the device table once, so a gateway with many devices
+   * neither reallocates nor walks a list per message.
+   */
+  ThingMQTTAdapter(String _name, String mqttbroker_Address_,
+                   size_t maxDevices_ = THING_MAX_DEVICES)
+      : name(_name), maxDevices(maxDevices_)
   {
     mqttbroker_Address.concat(mqttbroker_Address_);
+    devices = new ThingDevice *[maxDevices];
   }
 
+  ~ThingMQTTAdapter()
+  {
+    delete[] devices;
+  }
+
+  ThingMQTTAdapter(const ThingMQTTAdapter &) = delete;
+  ThingMQTTAdapter &operator=(const ThingMQTTAdapter &) = delete;
+
   bool begin()
   {
     uint8_t mac[6];
@@ -64,13 +165,28 @@ public:
     sprintf(macStr, "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     MAC = String(macStr);
     MAC.toLowerCase();
+
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      assignThingId(devices[i]);
+    }
+    buildRoutes();
+    executor.begin();
     // create the TD
 
     esp_mqtt_client_config_t mqtt_cfg = {};
 
     mqtt_cfg.uri = mqttbroker_Address.c_str();
+    // a stable client id and clean_session off let the broker keep the
+    // subscriptions and unacknowledged QoS1 messages across reconnects
+    clientId = "thing-" + MAC;
+    mqtt_cfg.client_id = clientId.c_str();
+    mqtt_cfg.disable_clean_session = true;
+    mqtt_cfg.keepalive = keepAliveSeconds;
+    // reconnects are scheduled by update(), see ThingConnectionManager
+    mqtt_cfg.disable_auto_reconnect = true;
 
-    get_TD();
+    buildDescriptionCaches();
 
     // if for later integration
     // if (mqtt_needs_Auth)
@@ -91,52 +207,318 @@ public:
 
     esp_mqtt_client_register_event(mqtt_client, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
 
+    outbox.begin(mqtt_client);
+    mqtt_outbox = &outbox;
+
+    if (journalEnabled && journal.begin(mqtt_client))
+    {
+      mqtt_journal_append = journal_append;
+      outbox.setJournaledHook(journal_delivered);
+    }
+
     // then connect to broker
 
+    connection.started(millis());
     esp_mqtt_client_start(mqtt_client);
 
     return true;
   }
 
+  /**
+   * Publishes the TD of every device again, e.g. after a reconnect; the
+   * publish itself happens in update(), on the loop task.
+   */
   void publish_TD()
   {
-    ThingDevice *device = this->firstDevice;
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      devices[i]->publishedDescriptionVersion = 0;
+    }
+  }
+
+  /**
+   * Publishes the cached TD of device, retained, on things/<thingId>. A TD
+   * larger than THING_TD_INLINE_LIMIT or than one cache chunk is published
+   * as numbered parts on things/<thingId>/td/<n>, with
+   * {"parts":n,"size":bytes,"version":v} on things/<thingId>, so it never
+   * has to be copied into one buffer.
+   */
+  void publishDescription(ThingDevice *device)
+  {
+    const ThingChunkBuffer &td = device->cachedDescription(mqttbroker_Address);
+    if (td.overflow())
+    {
+      Serial.println("TD incomplete, out of memory");
+      return;
+    }
+
+    const char *suffix = thing_encoding_topic_suffix(encoding);
+    String topic = device->topicBase + suffix;
+    size_t parts = 0;
+
+    if (td.chunkCount() == 1 && td.length() <= THING_TD_INLINE_LIMIT)
+    {
+      size_t len;
+      const char *data = td.chunk(0, &len);
+      thing_mqtt_publish(topic.c_str(), data, len, 1, true);
+    }
+    else
+    {
+      parts = td.chunkCount();
+      for (size_t i = 0; i < parts; i++)
+      {
+        size_t len;
+        const char *data = td.chunk(i, &len);
+        String partTopic = device->topicBase + "/td/" + i + suffix;
+        thing_mqtt_publish(partTopic.c_str(), data, len, 1, true);
+      }
+
+      char manifest[64];
+      ThingBufferPrint out(manifest, sizeof(manifest));
+      ThingObjectWriter writer(out, encoding, 3);
+      StaticJsonDocument<64> values;
+      values["parts"] = parts;
+      values["size"] = td.length();
+      values["version"] = device->descriptionVersion;
+      writer.members(values.as<JsonObjectConst>());
+      writer.end();
+      thing_mqtt_publish(topic.c_str(), manifest, out.length(), 1, true);
+    }
+
+    // clear retained parts of a previous, larger TD
+    for (size_t i = parts; i < device->publishedDescriptionParts; i++)
+    {
+      String partTopic = device->topicBase + "/td/" + i + suffix;
+      thing_mqtt_publish(partTopic.c_str(), "", 0, 1, true);
+    }
+    device->publishedDescriptionParts = parts;
+    device->publishedDescriptionVersion = device->descriptionVersion;
+    device->descriptionRetained = true;
+  }
+
+  // removes the retained TD of a disabled device from the broker
+  void clearDescription(ThingDevice *device)
+  {
+    const char *suffix = thing_encoding_topic_suffix(encoding);
+    String topic = device->topicBase + suffix;
+    thing_mqtt_publish(topic.c_str(), "", 0, 1, true);
+    for (size_t i = 0; i < device->publishedDescriptionParts; i++)
+    {
+      String partTopic = device->topicBase + "/td/" + i + suffix;
+      thing_mqtt_publish(partTopic.c_str(), "", 0, 1, true);
+    }
+    device->publishedDescriptionParts = 0;
+    device->descriptionRetained = false;
+  }
 
-    // publish the device TD on its topics
-    while (device != nullptr)
+  // request topics, called on every (re)connect
+  void subscribe()
+  {
+    for (size_t i = 0; i < deviceCount; i++)
     {
-      String abs_path_td = "things/" + MAC;
-      Serial.println(abs_path_td);
+      subscribe(devices[i]);
+    }
+  }
 
-      // publish here
-      esp_mqtt_client_publish(mqtt_client, abs_path_td.c_str(), test_TD.c_str(), 0, 1, 1);
+  // request topics of one device; subscribing again is harmless
+  void subscribe(ThingDevice *device)
+  {
+    String topic = device->topicBase + "/properties/+/set";
+    esp_mqtt_client_subscribe(mqtt_client, topic.c_str(), 1);
+    topic = device->topicBase + "/properties/+/history/get";
+    esp_mqtt_client_subscribe(mqtt_client, topic.c_str(), 0);
+    topic = device->topicBase + "/actions/+";
+    esp_mqtt_client_subscribe(mqtt_client, topic.c_str(), 1);
+  }
 
-      device = device->next;
+  /**
+   * Compiles the request topics of all devices into the router; done once
+   * in begin() and again when a device is added afterwards.
+   */
+  void buildRoutes()
+  {
+    router.clear();
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      ThingDevice *device = devices[i];
+      router.add((device->topicBase + "/properties/+/set").c_str(), onPropertySet, device);
+      router.add((device->topicBase + "/properties/+/history/get").c_str(), onHistoryGet, device);
+      router.add((device->topicBase + "/actions/+").c_str(), onActionRequest, device);
     }
   }
 
-  void get_TD()
+  /**
+   * MQTT_EVENT_DATA, in the MQTT task. data is the client's receive
+   * buffer, valid for this call, so the request is copied to the inbox and
+   * applied by update(), on the thread that owns the devices. It is
+   * dropped if the inbox is full or it does not fit a slot.
+   */
+  void handleMessage(const char *topic, size_t topicLen, const char *data, size_t dataLen)
   {
-    DynamicJsonDocument buf(LARGE_JSON_DOCUMENT_SIZE);
+    ThingLock lock(inboxMutex);
+    if (topicLen >= THING_OUTBOX_TOPIC_SIZE || dataLen > THING_INBOX_PAYLOAD_SIZE ||
+        inboxCount == THING_INBOX_SLOTS)
+    {
+      droppedRequests++;
+      return;
+    }
 
-    JsonObject thing = buf.to<JsonObject>();
-    ThingDevice *device = this->firstDevice;
+    InboxSlot &slot = inbox[(inboxHead + inboxCount) % THING_INBOX_SLOTS];
+    memcpy(slot.topic, topic, topicLen);
+    slot.topicLen = topicLen;
+    memcpy(slot.payload, data, dataLen);
+    slot.len = dataLen;
+    inboxCount++;
+  }
 
-    while (device != nullptr)
+  // requests handleMessage() had no room for
+  uint32_t getDroppedRequests()
+  {
+    ThingLock lock(inboxMutex);
+    return droppedRequests;
+  }
+
+  /**
+   * .../properties/<id>/set with {"<id>": value} (as for HTTP PUT) or the
+   * bare value. Only properties with a callback are writable.
+   */
+  static void onPropertySet(void *context, const ThingRouteMatch &match, char *payload, size_t len)
+  {
+    ThingDevice *device = (ThingDevice *)context;
+    if (!device->enabled)
     {
-      device->serialize(thing, mqttbroker_Address, MAC);
-      device = device->next;
+      return;
+    }
+    ThingProperty *property = device->findProperty(match.captures[0], match.lengths[0]);
+    if (property == nullptr || !property->isWritable())
+    {
+      return;
     }
 
-    serializeJson(thing, test_TD);
+    // parsed in place: strings point into the payload, which outlives
+    // setProperty() as that copies what it keeps
+    StaticJsonDocument<SMALL_JSON_DOCUMENT_SIZE> doc;
+    if (deserializeJson(doc, payload, len))
+    {
+      return;
+    }
 
-    TD_len = test_TD.length();
+    JsonVariant value = doc.as<JsonVariant>();
+    if (doc.is<JsonObject>() && doc.containsKey(property->id))
+    {
+      value = doc[property->id];
+    }
+    device->setProperty(property->id.c_str(), value);
+  }
 
-    Serial.printf("TD len = %d\n", TD_len);
+  static void onHistoryGet(void *context, const ThingRouteMatch &match, char *payload, size_t len)
+  {
+    ThingDevice *device = (ThingDevice *)context;
+    ThingProperty *property = device->findProperty(match.captures[0], match.lengths[0]);
+    if (device->enabled && property != nullptr)
+    {
+      mqttAdapter->publishHistory(device, property, payload, len);
+    }
+  }
+
+  /**
+   * .../actions/<name> with {"<name>": {"input": ...}}, the body of an HTTP
+   * action request. The action runs on the executor.
+   */
+  static void onActionRequest(void *context, const ThingRouteMatch &match, char *payload,
+                              size_t len)
+  {
+    ThingDevice *device = (ThingDevice *)context;
+    ThingAction *action = device->enabled
+                              ? device->findAction(match.captures[0], match.lengths[0])
+                              : nullptr;
+    if (action == nullptr)
+    {
+      return;
+    }
+
+    // the request outlives the receive buffer, so this parse copies strings
+    DynamicJsonDocument *request = new DynamicJsonDocument(SMALL_JSON_DOCUMENT_SIZE);
+    if (deserializeJson(*request, (const char *)payload, len) ||
+        !request->containsKey(action->id))
+    {
+      delete request;
+      return;
+    }
+
+    ThingActionObject *obj = device->requestAction(request);
+    if (obj == nullptr)
+    {
+      delete request;
+      return;
+    }
+
+    if (!mqttAdapter->executor.submit(obj))
+    {
+      device->removeAction(obj->id); // also frees request
+    }
+  }
+
+  /**
+   * Answers a history request on .../properties/<id>/history. The optional
+   * JSON request payload selects {"resolution": "raw"|"1m"|"15m",
+   * "since": <epoch ms>}. An answer larger than THING_CHUNK_SIZE is
+   * published as numbered parts on .../history/<n>, with
+   * {"parts":n,"size":bytes} on .../history, as a large TD is.
+   */
+  void publishHistory(ThingDevice *device, ThingProperty *property, const char *data,
+                      size_t dataLen)
+  {
+    ThingHistory *history = property->getHistory();
+    if (history == nullptr)
+    {
+      return;
+    }
+
+    ThingHistoryResolution resolution = HISTORY_RAW;
+    int64_t sinceMs = 0;
+    StaticJsonDocument<128> request;
+    if (dataLen > 0 && !deserializeJson(request, data, dataLen))
+    {
+      const char *r = request["resolution"] | "raw";
+      resolution = ThingHistory::parseResolution(r, strlen(r));
+      sinceMs = request["since"] | (int64_t)0;
+    }
+
+    const char *suffix = thing_encoding_topic_suffix(encoding);
+    String topic = device->topicBase + "/properties/" + property->id + "/history";
+    size_t len = history->measure(resolution, sinceMs, encoding);
+    if (len <= THING_CHUNK_SIZE)
+    {
+      char payload[THING_CHUNK_SIZE];
+      ThingBufferPrint out(payload, sizeof(payload));
+      history->print(out, resolution, sinceMs, encoding);
+      thing_mqtt_publish((topic + suffix).c_str(), payload, out.length(), 0, false);
+      return;
+    }
 
-    Serial.println(test_TD);
+    ThingMQTTPartPrint parts(topic + "/", suffix, 0);
+    history->print(parts, resolution, sinceMs, encoding);
+    parts.end();
+
+    char manifest[48];
+    ThingBufferPrint out(manifest, sizeof(manifest));
+    ThingObjectWriter writer(out, encoding, 2);
+    StaticJsonDocument<JSON_OBJECT_SIZE(2)> values;
+    values["parts"] = parts.partCount();
+    values["size"] = len;
+    writer.members(values.as<JsonObjectConst>());
+    writer.end();
+    thing_mqtt_publish((topic + suffix).c_str(), manifest, out.length(), 0, false);
+  }
 
-    // serializeJson(thing, TD);
+  // builds the TD cache of every device up front, see cachedDescription()
+  void buildDescriptionCaches()
+  {
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      devices[i]->cachedDescription(mqttbroker_Address);
+    }
   }
 
   void update()
@@ -144,25 +526,246 @@ public:
 #ifdef ESP8266
     MDNS.update();
 #endif
+    uint32_t now = millis();
+    bool connected = outbox.isConnected();
+    handleRequests();
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      ThingDevice *device = devices[i];
+      if (!device->enabled)
+      {
+        if (connected && device->descriptionRetained)
+        {
+          clearDescription(device);
+        }
+        continue;
+      }
+      device->update(now);
+      if (connected && device->publishedDescriptionVersion != device->descriptionVersion)
+      {
+        publishDescription(device);
+      }
+    }
+
+    if (mqtt_journal_append != nullptr && outbox.isConnected())
+    {
+      journal.replay(now);
+    }
+
+    if (mqtt_client != nullptr && connection.due(now) &&
+        esp_mqtt_client_reconnect(mqtt_client) != ESP_OK)
+    {
+      // the client was not ready for it, try again later
+      connection.disconnected(now);
+    }
+  }
+
+  // false when the device table is full
+  bool addDevice(ThingDevice *device)
+  {
+    if (deviceCount == maxDevices)
+    {
+      Serial.println("device table full");
+      return false;
+    }
+    if (deviceCount > 0)
+    {
+      devices[deviceCount - 1]->next = device;
+    }
+    devices[deviceCount++] = device;
+
+    device->setEncoding(encoding);
+    device->setCompact(compact);
+    if (publishIntervalMs > 0)
+    {
+      device->setBatching(publishIntervalMs, keepPropertyTopics);
+      assignPublishSlots();
+    }
+    if (MAC.length() > 0)
+    {
+      assignThingId(device);
+      buildRoutes();
+      // the CONNECTED handler only covers the devices it already knew
+      if (outbox.isConnected())
+      {
+        subscribe(device);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Gateway mode: every device publishes one snapshot per intervalMs (see
+   * setBatching()), and the devices get evenly spaced publish slots in
+   * that interval, i * intervalMs / devices for the i-th, so N devices do
+   * not all publish at once. Call before begin().
+   */
+  void setPublishSchedule(uint32_t intervalMs, bool keepPropertyTopics_ = false)
+  {
+    publishIntervalMs = intervalMs;
+    keepPropertyTopics = keepPropertyTopics_;
+    setBatching(intervalMs, keepPropertyTopics);
+    assignPublishSlots();
+  }
+
+  /**
+   * Stops or resumes publishing for one device at runtime, see
+   * ThingDevice::setEnabled(). Its retained TD is removed while it is
+   * disabled and published again when it is enabled; the TDs of the other
+   * devices are left alone. Requests to a disabled device are ignored.
+   */
+  void setDeviceEnabled(ThingDevice *device, bool enabled)
+  {
+    if (device->enabled == enabled)
+    {
+      return;
+    }
+    device->setEnabled(enabled);
+    if (enabled)
+    {
+      device->publishedDescriptionVersion = 0;
+    }
+  }
+
+  /**
+   * Switches every device to snapshot publishing, see
+   * ThingDevice::setBatching(). Call before begin() so the TD advertises
+   * the state topic.
+   */
+  void setBatching(uint32_t windowMs, bool keepPropertyTopics = false)
+  {
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      devices[i]->setBatching(windowMs, keepPropertyTopics);
+    }
+  }
+
+  /**
+   * Selects JSON (default) or MessagePack for value, snapshot and TD
+   * publishes. MessagePack is published on topics with a "/msgpack" suffix,
+   * so subscribers choose the encoding by topic. Call before begin().
+   */
+  void setEncoding(ThingEncoding encoding_)
+  {
+    encoding = encoding_;
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      devices[i]->setEncoding(encoding);
+    }
+  }
+
+  /**
+   * Publishes values on t/<thingId>/<alias> as [<epoch ms>,<value>]
+   * instead of things/<thingId>/properties/<id> as an object; the alias of
+   * each property is advertised in its TD form. See
+   * ThingDevice::setCompact(). Call before begin().
+   */
+  void setCompact(bool compact_ = true)
+  {
+    compact = compact_;
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      devices[i]->setCompact(compact);
+    }
+  }
+
+  /**
+   * Keeps QoS1 publishes made while the broker is unreachable in a SPIFFS
+   * journal and replays them after reconnecting, at most
+   * replayPerSecond messages per second. Call before begin().
+   */
+  void enableJournal(uint16_t replayPerSecond = THING_JOURNAL_REPLAY_PER_SECOND)
+  {
+    journalEnabled = true;
+    journal.setReplayRate(replayPerSecond);
+  }
+
+  /**
+   * MQTT keepalive in seconds; the broker drops the session after 1.5
+   * times this without traffic. Call before begin().
+   */
+  void setKeepAlive(uint16_t seconds)
+  {
+    keepAliveSeconds = seconds;
   }
 
-  void addDevice(ThingDevice *device)
+  /**
+   * Bounds of the reconnect delay: the first attempt after a disconnect
+   * waits up to minMs, every further one up to twice as long as the one
+   * before, capped at maxMs.
+   */
+  void setReconnectBackoff(uint32_t minMs, uint32_t maxMs)
   {
-    if (this->lastDevice == nullptr)
+    connection.setBackoff(minMs, maxMs);
+  }
+
+  // the connection state is tracked for the outbox by the event handler
+  void setConnected(bool connected)
+  {
+    uint32_t now = millis();
+    if (connected)
     {
-      this->firstDevice = device;
-      this->lastDevice = device;
+      connection.connected(now);
     }
     else
     {
-      this->lastDevice->next = device;
-      this->lastDevice = device;
+      connection.disconnected(now);
+    }
+    outbox.setConnected(connected);
+    if (!connected && mqtt_journal_append != nullptr)
+    {
+      journal.connectionLost();
     }
   }
 
+  void published(int msgId)
+  {
+    if (mqtt_journal_append != nullptr)
+    {
+      journal.acknowledged(msgId);
+    }
+  }
+
+  bool appendJournal(const char *topic, const char *payload, size_t len)
+  {
+    return journal.append(topic, payload, len);
+  }
+
+  void journalDelivered(const char *topic, const char *payload, size_t len)
+  {
+    journal.delivered(topic, payload, len);
+  }
+
+  ThingJournalStats getJournalStats()
+  {
+    return journal.getStats();
+  }
+
+  ThingOutboxStats getOutboxStats()
+  {
+    return outbox.getStats();
+  }
+
+  ThingConnectionStats getConnectionStats()
+  {
+    return connection.getStats();
+  }
+
+  // the MAC for the first device, "<MAC>-<id>" for the others
+  void assignThingId(ThingDevice *device)
+  {
+    device->thingId = device == devices[0] ? MAC : MAC + "-" + device->id;
+    device->setTopicBase("things/" + device->thingId);
+  }
+
   ThingDevice *get_devices()
   {
-    return this->firstDevice;
+    return deviceCount > 0 ? devices[0] : nullptr;
+  }
+
+  size_t getDeviceCount()
+  {
+    return deviceCount;
   }
 
   void setmqttbroker_Credentials(String mqttauth_Username_, String mqttauth_Password_)
@@ -177,14 +780,87 @@ private:
   String mqttauth_Username;
   String mqttauth_Password;
   String MAC;
+  String clientId;
+  uint16_t keepAliveSeconds = THING_MQTT_KEEPALIVE_S;
+  ThingEncoding encoding = THING_ENCODING_JSON;
+  bool compact = false;
+  ThingMQTTOutbox outbox;
+  ThingConnectionManager connection;
+  ThingJournal journal;
+  ThingRouter router;
+  ThingActionExecutor executor;
+  bool journalEnabled = false;
+
+  struct InboxSlot
+  {
+    char topic[THING_OUTBOX_TOPIC_SIZE];
+    size_t topicLen;
+    char payload[THING_INBOX_PAYLOAD_SIZE];
+    size_t len;
+  };
+
+  // filled by the MQTT task, emptied by update()
+  InboxSlot inbox[THING_INBOX_SLOTS];
+  size_t inboxHead = 0;
+  size_t inboxCount = 0;
+  uint32_t droppedRequests = 0;
+  ThingMutex inboxMutex;
+  // the request being handled, parsed in place by the router's handlers
+  InboxSlot request;
   uint16_t port;
   bool disableHostValidation;
-  ThingDevice *firstDevice = nullptr;
-  ThingDevice *lastDevice = nullptr;
+  // devices in the order they were added, also chained through next
+  ThingDevice **devices;
+  size_t maxDevices;
+  size_t deviceCount = 0;
+  // see setPublishSchedule()
+  uint32_t publishIntervalMs = 0;
+  bool keepPropertyTopics = false;
+
+  // applies the requests queued by handleMessage(), oldest first
+  void handleRequests()
+  {
+    for (;;)
+    {
+      {
+        ThingLock lock(inboxMutex);
+        if (inboxCount == 0)
+        {
+          return;
+        }
+        request = inbox[inboxHead];
+        inboxHead = (inboxHead + 1) % THING_INBOX_SLOTS;
+        inboxCount--;
+      }
+      router.dispatch(request.topic, request.topicLen, request.payload, request.len);
+    }
+  }
+
+  void assignPublishSlots()
+  {
+    if (publishIntervalMs == 0)
+    {
+      return;
+    }
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+      devices[i]->setPublishSlot((uint32_t)((uint64_t)publishIntervalMs * i / deviceCount));
+    }
+  }
 };
 
 ThingMQTTAdapter *mqttAdapter;
 
+static bool journal_append(const char *topic, const char *payload, size_t len)
+{
+  return mqttAdapter->appendJournal(topic, payload, len);
+}
+
+static void journal_delivered(const char *topic, const char *payload, size_t len)
+{
+  mqttAdapter->journalDelivered(topic, payload, len);
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
   // ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
@@ -195,12 +871,16 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
   {
   case MQTT_EVENT_CONNECTED:
     Serial.println("Connected to MQTT broker, publishing TD");
+    mqttAdapter->setConnected(true);
     mqttAdapter->publish_TD();
+    // also on a resumed session: the broker may not have kept every
+    // subscription, e.g. of a device added while offline
+    mqttAdapter->subscribe();
     // msg_id = esp_mqtt_client_publish(client, "/topic/qos1", "data_3", 0, 1, 0);
     break;
-  // case MQTT_EVENT_DISCONNECTED:
-  //   ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
-  //   break;
+  case MQTT_EVENT_DISCONNECTED:
+    mqttAdapter->setConnected(false);
+    break;
 
   // case MQTT_EVENT_SUBSCRIBED:
   //   ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -210,14 +890,16 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
   // case MQTT_EVENT_UNSUBSCRIBED:
   //   ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
   //   break;
-  // case MQTT_EVENT_PUBLISHED:
-  //   ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-  //   break;
-  // case MQTT_EVENT_DATA:
-  //   ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-  //   printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-  //   printf("DATA=%.*s\r\n", event->data_len, event->data);
-  //   break;
+  case MQTT_EVENT_PUBLISHED:
+    mqttAdapter->published(event->msg_id);
+    break;
+  case MQTT_EVENT_DATA:
+    // messages larger than the receive buffer arrive in pieces, requests never are
+    if (event->current_data_offset == 0 && event->data_len == event->total_data_len)
+    {
+      mqttAdapter->handleMessage(event->topic, event->topic_len, event->data, event->data_len);
+    }
+    break;
   // case MQTT_EVENT_ERROR:
   //   ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
   //   if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT)
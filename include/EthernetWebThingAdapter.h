@@ -33,6 +33,9 @@
 
 #define WITHOUT_WS 1
 #include "Thing.h"
+#include "ThingActionExecutor.h"
+#include "ThingHttpRequest.h"
+#include "ThingRouter.h"
 
 #ifndef LARGE_JSON_DOCUMENT_SIZE
 #ifdef LARGE_JSON_BUFFERS
@@ -50,6 +53,42 @@
 #endif
 #endif
 
+// a client that sends nothing for this long is dropped
+#ifndef THING_HTTP_REQUEST_TIMEOUT_MS
+#define THING_HTTP_REQUEST_TIMEOUT_MS 5000
+#endif
+
+// persistent connections, see WebThingAdapter::setKeepAlive()
+#ifndef THING_HTTP_KEEP_ALIVE_TIMEOUT_MS
+#define THING_HTTP_KEEP_ALIVE_TIMEOUT_MS 5000
+#endif
+
+#ifndef THING_HTTP_KEEP_ALIVE_MAX_REQUESTS
+#define THING_HTTP_KEEP_ALIVE_MAX_REQUESTS 100
+#endif
+
+// connections served at once, each with a THING_HTTP_REQUEST_SIZE buffer;
+// the W5100 has 4 sockets, the W5500 8
+#ifndef THING_HTTP_SLOTS
+#define THING_HTTP_SLOTS 4
+#endif
+
+// slots that may hold a long poll or an event stream, the others are kept
+// for ordinary requests
+#ifndef THING_HTTP_PARKED_SLOTS
+#define THING_HTTP_PARKED_SLOTS (THING_HTTP_SLOTS - 1)
+#endif
+
+// upper bound of ?wait=<seconds> on a long poll
+#ifndef THING_HTTP_LONGPOLL_TIMEOUT_MS
+#define THING_HTTP_LONGPOLL_TIMEOUT_MS 30000
+#endif
+
+// an idle event stream gets a comment line this often
+#ifndef THING_HTTP_SSE_HEARTBEAT_MS
+#define THING_HTTP_SSE_HEARTBEAT_MS 15000
+#endif
+
 static const bool DEBUG = false;
 
 enum HTTPMethod {
@@ -61,14 +100,42 @@ enum HTTPMethod {
   HTTP_OPTIONS
 };
 
-enum ReadState {
-  STATE_READ_METHOD,
-  STATE_READ_URI,
-  STATE_DISCARD_HTTP11,
-  STATE_DISCARD_HEADERS_PRE_HOST,
-  STATE_READ_HOST,
-  STATE_DISCARD_HEADERS_POST_HOST,
-  STATE_READ_CONTENT
+enum HTTPRouteKind {
+  ROUTE_THING,
+  ROUTE_PROPERTIES,
+  ROUTE_ACTIONS,
+  ROUTE_EVENTS,
+  ROUTE_PROPERTY,
+  ROUTE_PROPERTY_HISTORY,
+  ROUTE_ACTION,
+  ROUTE_ACTION_ID,
+  ROUTE_EVENT
+};
+
+// what a slot holding back its response waits for
+enum HTTPParkKind {
+  PARK_NONE,
+  PARK_PROPERTY,
+  PARK_EVENT,
+  PARK_STREAM
+};
+
+struct ThingHttpStats {
+  uint8_t slots = 0;
+  // slots with a connection
+  uint8_t busy = 0;
+  uint8_t peakBusy = 0;
+  // slots holding a long poll or an event stream
+  uint8_t parked = 0;
+  uint32_t accepted = 0;
+  // clients that found every slot busy
+  uint32_t waited = 0;
+  // how long the last and the longest of those waited for a slot
+  uint32_t lastWaitMs = 0;
+  uint32_t maxWaitMs = 0;
+  // from the first bytes of a request to its handling
+  uint32_t lastQueueMs = 0;
+  uint32_t maxQueueMs = 0;
 };
 
 class WebThingAdapter {
@@ -92,6 +159,11 @@ public:
     }
   }
 
+  ~WebThingAdapter() { delete[] routes; }
+
+  WebThingAdapter(const WebThingAdapter &) = delete;
+  WebThingAdapter &operator=(const WebThingAdapter &) = delete;
+
   void begin() {
     name.toLowerCase();
 #ifdef CONFIG_MDNS
@@ -101,6 +173,9 @@ public:
     mdns.addServiceRecord(serviceName.c_str(), port, MDNSServiceTCP,
                           "\x06path=/");
 #endif
+    executor.begin();
+    etagSalt = thing_random() ^ micros();
+    buildRoutes();
     server.begin();
   }
 
@@ -108,125 +183,43 @@ public:
 #ifdef CONFIG_MDNS
     mdns.run();
 #endif
-    if (!client) {
-      EthernetClient client = server.available();
-      if (!client) {
-        return;
-      }
-      if (DEBUG) {
-        Serial.println("New client available");
-      }
-      this->client = client;
-    }
+    executor.poll();
+    acceptClient();
 
-    if (!client.connected()) {
-      if (DEBUG) {
-        Serial.println("Client disconnected");
+    for (size_t i = 0; i < THING_HTTP_SLOTS; i++) {
+      if (slots[i].client && slots[i].park == PARK_STREAM) {
+        scanChanges();
+        break;
       }
-      resetParser();
-      client.stop();
-      return;
     }
 
-    char c = client.read();
-    if (c == 255 || c == -1) {
-      if (state == STATE_READ_CONTENT) {
-        handleRequest();
-        resetParser();
-      }
-
-      retries += 1;
-      if (retries > 5000) {
-        if (DEBUG) {
-          Serial.println("Giving up on client");
-        }
-        resetParser();
-        client.stop();
+    // one step per connection, starting with a different one every time
+    for (size_t i = 0; i < THING_HTTP_SLOTS; i++) {
+      HttpSlot &next = slots[(firstSlot + i) % THING_HTTP_SLOTS];
+      if (next.client) {
+        serviceSlot(next);
       }
-      return;
     }
+    firstSlot = (firstSlot + 1) % THING_HTTP_SLOTS;
+  }
 
-    switch (state) {
-    case STATE_READ_METHOD:
-      if (c == ' ') {
-        if (methodRaw == "GET") {
-          method = HTTP_GET;
-        } else if (methodRaw == "POST") {
-          method = HTTP_POST;
-        } else if (methodRaw == "PUT") {
-          method = HTTP_PUT;
-        } else if (methodRaw == "DELETE") {
-          method = HTTP_DELETE;
-        } else if (methodRaw == "OPTIONS") {
-          method = HTTP_OPTIONS;
-        } else {
-          method = HTTP_ANY;
-        }
-        state = STATE_READ_URI;
-      } else {
-        methodRaw += c;
-      }
-      break;
-
-    case STATE_READ_URI:
-      if (c == ' ') {
-        state = STATE_DISCARD_HTTP11;
-      } else {
-        uri += c;
-      }
-      break;
-
-    case STATE_DISCARD_HTTP11:
-      if (c == '\r') {
-        state = STATE_DISCARD_HEADERS_PRE_HOST;
-      }
-      break;
-
-    case STATE_DISCARD_HEADERS_PRE_HOST:
-      if (c == '\r') {
-        break;
-      }
-      if (c == '\n') {
-        headerRaw = "";
-        break;
-      }
-      if (c == ':') {
-        if (headerRaw.equalsIgnoreCase("Host")) {
-          state = STATE_READ_HOST;
-        }
-        break;
-      }
-
-      headerRaw += c;
-      break;
-
-    case STATE_READ_HOST:
-      if (c == '\r') {
-        returnsAndNewlines = 1;
-        state = STATE_DISCARD_HEADERS_POST_HOST;
-        break;
-      }
-      if (c == ' ') {
-        break;
-      }
-      host += c;
-      break;
-
-    case STATE_DISCARD_HEADERS_POST_HOST:
-      if (c == '\r' || c == '\n') {
-        returnsAndNewlines += 1;
-      } else {
-        returnsAndNewlines = 0;
+  /**
+   * Slot occupancy and waiting times, for monitoring. Waiting for a slot
+   * is measured from when a client with a request is first seen while all
+   * slots are busy.
+   */
+  ThingHttpStats getHttpStats() {
+    ThingHttpStats s = stats;
+    s.slots = THING_HTTP_SLOTS;
+    s.busy = 0;
+    s.parked = 0;
+    for (size_t i = 0; i < THING_HTTP_SLOTS; i++) {
+      if (slots[i].client) {
+        s.busy++;
+        s.parked += slots[i].park != PARK_NONE;
       }
-      if (returnsAndNewlines == 4) {
-        state = STATE_READ_CONTENT;
-      }
-      break;
-
-    case STATE_READ_CONTENT:
-      content += c;
-      break;
     }
+    return s;
   }
 
   void addDevice(ThingDevice *device) {
@@ -237,53 +230,349 @@ public:
       this->lastDevice->next = device;
       this->lastDevice = device;
     }
+    if (routes != nullptr) {
+      buildRoutes();
+    }
+  }
+
+  /**
+   * Lets HTTP/1.1 clients send further requests on a connection: it is
+   * closed after idleTimeoutMs without a request or after maxRequests
+   * requests. 0 closes every connection after its first response.
+   */
+  void setKeepAlive(uint32_t idleTimeoutMs,
+                    uint16_t maxRequests = THING_HTTP_KEEP_ALIVE_MAX_REQUESTS) {
+    keepAliveTimeoutMs = idleTimeoutMs;
+    keepAliveMaxRequests = maxRequests;
   }
 
 private:
+  // what a path resolves to, the router's context for it
+  struct Route {
+    WebThingAdapter *adapter;
+    HTTPRouteKind kind;
+    ThingDevice *device;
+    void *target;
+    // property routes: the value version last seen by scanChanges() and
+    // the change sequence number it got
+    uint32_t version;
+    uint32_t changed;
+  };
+
   String name, ip;
   uint16_t port;
   bool disableHostValidation;
   EthernetServer server;
-  EthernetClient client;
+  ThingActionExecutor executor;
 #ifdef CONFIG_MDNS
   EthernetUDP udp;
   MDNS mdns;
 #endif
 
-  ReadState state = STATE_READ_METHOD;
-  String uri = "";
+  // one connection with its own parser
+  struct HttpSlot {
+    EthernetClient client;
+    ThingHttpRequest request;
+    uint32_t lastReceivedMs = 0;
+    // when the first bytes of the pending request arrived
+    uint32_t requestStartedMs = 0;
+    uint16_t requests = 0;
+    // the current response leaves the connection open
+    bool keepConnection = false;
+    // the response is held back until something changes, see park()
+    HTTPParkKind park = PARK_NONE;
+    ThingDevice *parkDevice = nullptr;
+    ThingItem *parkItem = nullptr;
+    // what the client has seen: the property's value version or, for a
+    // stream, changeSeq; and the device's count of queued events
+    uint32_t parkVersion = 0;
+    uint32_t parkEvents = 0;
+    // parked or, for a stream, last written to
+    uint32_t parkedMs = 0;
+    uint32_t parkTimeoutMs = 0;
+  };
+
+  HttpSlot slots[THING_HTTP_SLOTS];
+  // the slot being served by the handlers
+  HttpSlot *slot = &slots[0];
+  size_t firstSlot = 0;
+  ThingHttpStats stats;
+  // a client is waiting for a free slot since waitingSinceMs
+  bool waiting = false;
+  uint32_t waitingSinceMs = 0;
+
   HTTPMethod method = HTTP_ANY;
-  String content = "";
-  String methodRaw = "";
-  String host = "";
-  String headerRaw = "";
-  int returnsAndNewlines = 0;
-  int retries = 0;
+  // validator of the current response, see notModified()
+  char etag[16] = "";
+  // mixed into value ETags, which restart with the version counters
+  uint32_t etagSalt = 0;
+  uint32_t keepAliveTimeoutMs = THING_HTTP_KEEP_ALIVE_TIMEOUT_MS;
+  uint16_t keepAliveMaxRequests = THING_HTTP_KEEP_ALIVE_MAX_REQUESTS;
+  ThingEncoding encoding = THING_ENCODING_JSON;
 
   ThingDevice *firstDevice = nullptr, *lastDevice = nullptr;
+  ThingRouter router;
+  Route *routes = nullptr;
+  size_t routeCount = 0;
+  // numbers the property changes found by scanChanges()
+  uint32_t changeSeq = 0;
+
+  /**
+   * Compiles the paths of all devices, properties, actions and events into
+   * the router, so a request is matched segment by segment without
+   * building strings. Done in begin() and again for every device added
+   * afterwards; items added to a device after that are not routed.
+   */
+  void buildRoutes() {
+    size_t count = 0;
+    for (ThingDevice *device = firstDevice; device != nullptr;
+         device = device->next) {
+      count += 4;
+      for (ThingItem *item = device->firstProperty; item != nullptr;
+           item = item->next) {
+        count += 2;
+      }
+      for (ThingAction *action = device->firstAction; action != nullptr;
+           action = action->next) {
+        count += 2;
+      }
+      for (ThingItem *item = device->firstEvent; item != nullptr;
+           item = item->next) {
+        count++;
+      }
+    }
+
+    router.clear();
+    delete[] routes;
+    routes = new Route[count > 0 ? count : 1];
+    routeCount = 0;
+
+    for (ThingDevice *device = firstDevice; device != nullptr;
+         device = device->next) {
+      String base = "things/" + device->id;
+      addRoute(base, ROUTE_THING, device, device);
+      addRoute(base + "/properties", ROUTE_PROPERTIES, device, device);
+      addRoute(base + "/actions", ROUTE_ACTIONS, device, device);
+      addRoute(base + "/events", ROUTE_EVENTS, device, device);
+
+      for (ThingItem *item = device->firstProperty; item != nullptr;
+           item = item->next) {
+        String path = base + "/properties/" + item->id;
+        addRoute(path, ROUTE_PROPERTY, device, item);
+        addRoute(path + "/history", ROUTE_PROPERTY_HISTORY, device, item);
+      }
+      for (ThingAction *action = device->firstAction; action != nullptr;
+           action = action->next) {
+        String path = base + "/actions/" + action->id;
+        addRoute(path, ROUTE_ACTION, device, action);
+        addRoute(path + "/+", ROUTE_ACTION_ID, device, action);
+      }
+      for (ThingItem *item = device->firstEvent; item != nullptr;
+           item = item->next) {
+        addRoute(base + "/events/" + item->id, ROUTE_EVENT, device, item);
+      }
+    }
+  }
+
+  void addRoute(const String &path, HTTPRouteKind kind, ThingDevice *device,
+                void *target) {
+    Route *route = &routes[routeCount++];
+    route->adapter = this;
+    route->kind = kind;
+    route->device = device;
+    route->target = target;
+    route->version =
+        kind == ROUTE_PROPERTY ? ((ThingItem *)target)->getValueVersion() : 0;
+    route->changed = 0;
+    router.add(path.c_str(), onRoute, route);
+  }
+
+  static void onRoute(void *context, const ThingRouteMatch &match, char *,
+                      size_t) {
+    Route *route = (Route *)context;
+    route->adapter->handleRoute(*route, match);
+  }
+
+  /**
+   * Takes a client with data waiting into a free slot. server.available()
+   * also returns clients that already have a slot; those are skipped.
+   */
+  void acceptClient() {
+    EthernetClient client = server.available();
+    if (!client) {
+      return;
+    }
+
+    HttpSlot *freeSlot = nullptr;
+    for (size_t i = 0; i < THING_HTTP_SLOTS; i++) {
+      if (slots[i].client == client) {
+        return;
+      }
+      if (freeSlot == nullptr && !slots[i].client) {
+        freeSlot = &slots[i];
+      }
+    }
+
+    uint32_t now = millis();
+    if (freeSlot == nullptr) {
+      if (!waiting) {
+        waiting = true;
+        waitingSinceMs = now;
+        stats.waited++;
+      }
+      return;
+    }
+
+    if (waiting) {
+      waiting = false;
+      stats.lastWaitMs = now - waitingSinceMs;
+      if (stats.lastWaitMs > stats.maxWaitMs) {
+        stats.maxWaitMs = stats.lastWaitMs;
+      }
+    }
+    if (DEBUG) {
+      Serial.println("New client available");
+    }
+    freeSlot->client = client;
+    freeSlot->lastReceivedMs = now;
+    stats.accepted++;
+
+    uint8_t busy = getHttpStats().busy;
+    if (busy > stats.peakBusy) {
+      stats.peakBusy = busy;
+    }
+  }
+
+  // reads what has arrived on one connection and answers what is complete
+  void serviceSlot(HttpSlot &next) {
+    slot = &next;
+    EthernetClient &client = slot->client;
+    ThingHttpRequest &request = slot->request;
+
+    if (!client.connected()) {
+      if (DEBUG) {
+        Serial.println("Client disconnected");
+      }
+      resetParser();
+      client.stop();
+      return;
+    }
+
+    // nothing is read until the held back response is sent
+    if (slot->park != PARK_NONE) {
+      if (!serviceParked()) {
+        return;
+      }
+      if (!slot->keepConnection) {
+        resetParser();
+        return;
+      }
+      answerRequests(request.next());
+      return;
+    }
+
+    int available = client.available();
+    if (available <= 0) {
+      // between requests of a persistent connection the shorter idle timeout
+      uint32_t timeoutMs = slot->requests > 0 && !request.pending()
+                               ? keepAliveTimeoutMs
+                               : THING_HTTP_REQUEST_TIMEOUT_MS;
+      if (millis() - slot->lastReceivedMs > timeoutMs) {
+        if (DEBUG) {
+          Serial.println("Giving up on client");
+        }
+        resetParser();
+        client.stop();
+      }
+      return;
+    }
+
+    // everything that has arrived, up to the room left in the request
+    size_t room;
+    char *space = request.space(&room);
+    int len = client.read((uint8_t *)space,
+                          (size_t)available < room ? available : room);
+    if (len <= 0) {
+      return;
+    }
+    slot->lastReceivedMs = millis();
+    if (!request.pending()) {
+      slot->requestStartedMs = slot->lastReceivedMs;
+    }
+
+    answerRequests(request.received(len));
+  }
+
+  // pipelined requests are answered back to back
+  void answerRequests(ThingHttpParseState state) {
+    while (state == THING_HTTP_COMPLETE) {
+      handleRequest();
+      if (slot->park != PARK_NONE) {
+        // the rest waits for serviceParked()
+        return;
+      }
+      if (!slot->keepConnection) {
+        resetParser();
+        return;
+      }
+      state = slot->request.next();
+    }
+    if (state == THING_HTTP_ERROR) {
+      handleStatus(slot->request.errorStatus());
+      resetParser();
+    }
+  }
 
   bool verifyHost() {
     if (disableHostValidation) {
       return true;
     }
 
-    int colonIndex = host.indexOf(':');
-    if (colonIndex >= 0) {
-      host.remove(colonIndex);
-    }
-    if (host.equalsIgnoreCase(name + ".local")) {
+    const char *host = slot->request.host();
+    const char *colon = strchr(host, ':');
+    size_t hostLen =
+        colon != nullptr ? colon - host : slot->request.hostLength();
+    String local = name + ".local";
+    if (thing_http_equals_ignore_case(host, hostLen, local.c_str())) {
       return true;
     }
-    if (host == ip) {
+    if (hostLen == ip.length() && strncmp(host, ip.c_str(), hostLen) == 0) {
       return true;
     }
-    if (host == "localhost") {
+    if (thing_http_equals_ignore_case(host, hostLen, "localhost")) {
       return true;
     }
     return false;
   }
 
+  static HTTPMethod parseMethod(const char *method) {
+    if (strcmp(method, "GET") == 0) {
+      return HTTP_GET;
+    } else if (strcmp(method, "POST") == 0) {
+      return HTTP_POST;
+    } else if (strcmp(method, "PUT") == 0) {
+      return HTTP_PUT;
+    } else if (strcmp(method, "DELETE") == 0) {
+      return HTTP_DELETE;
+    } else if (strcmp(method, "OPTIONS") == 0) {
+      return HTTP_OPTIONS;
+    }
+    return HTTP_ANY;
+  }
+
   void handleRequest() {
+    const char *uri = slot->request.uri();
+    method = parseMethod(slot->request.method());
+    etag[0] = '\0';
+    slot->requests++;
+    slot->keepConnection = slot->request.keepAlive() &&
+                           keepAliveTimeoutMs > 0 &&
+                           slot->requests < keepAliveMaxRequests;
+
+    stats.lastQueueMs = millis() - slot->requestStartedMs;
+    if (stats.lastQueueMs > stats.maxQueueMs) {
+      stats.maxQueueMs = stats.lastQueueMs;
+    }
     if (DEBUG) {
       Serial.print("handleRequest: ");
       Serial.print("method: ");
@@ -291,242 +580,417 @@ private:
       Serial.print("uri: ");
       Serial.println(uri);
       Serial.print("host: ");
-      Serial.println(host);
+      Serial.println(slot->request.host());
       Serial.print("content: ");
-      Serial.println(content);
+      Serial.println(slot->request.body());
     }
 
+    encoding = negotiateEncoding();
+
     if (!verifyHost()) {
-      client.println("HTTP/1.1 403 Forbidden");
-      client.println("Connection: close");
-      client.println();
-      delay(1);
-      client.stop();
+      handleStatus(403);
       return;
     }
 
-    if (uri == "/") {
+    if (strcmp(uri, "/") == 0) {
       handleThings();
       return;
     }
 
-    ThingDevice *device = this->firstDevice;
-    while (device != nullptr) {
-      String deviceBase = "/things/" + device->id;
-
-      if (uri.startsWith(deviceBase)) {
-        if (uri == deviceBase) {
-          if (method == HTTP_GET || method == HTTP_OPTIONS) {
-            handleThing(device);
-          } else {
-            handleError();
-          }
-          return;
-        } else if (uri == deviceBase + "/properties") {
-          if (method == HTTP_GET || method == HTTP_OPTIONS) {
-            handleThingPropertiesGet(device->firstProperty);
-          } else {
-            handleError();
-          }
-          return;
-        } else if (uri == deviceBase + "/actions") {
-          if (method == HTTP_GET || method == HTTP_OPTIONS) {
-            handleThingActionsGet(device);
-          } else if (method == HTTP_POST) {
-            handleThingActionsPost(device);
-          } else {
-            handleError();
-          }
-          return;
-        } else if (uri == deviceBase + "/events") {
-          if (method == HTTP_GET || method == HTTP_OPTIONS) {
-            handleThingEventsGet(device);
-          } else {
-            handleError();
-          }
-          return;
-        } else {
-          ThingProperty *property = device->firstProperty;
-          while (property != nullptr) {
-            String propertyBase = deviceBase + "/properties/" + property->id;
-            if (uri == propertyBase) {
-              if (method == HTTP_GET || method == HTTP_OPTIONS) {
-                handleThingPropertyGet(property);
-              } else if (method == HTTP_PUT) {
-                handleThingPropertyPut(device, property);
-              } else {
-                handleError();
-              }
-              return;
-            }
-            property = (ThingProperty *)property->next;
-          }
-
-          ThingAction *action = device->firstAction;
-          while (action != nullptr) {
-            String actionBase = deviceBase + "/actions/" + action->id;
-            if (uri == actionBase) {
-              if (method == HTTP_GET || method == HTTP_OPTIONS) {
-                handleThingActionGet(device, action);
-              } else if (method == HTTP_POST) {
-                handleThingActionPost(device, action);
-              } else {
-                handleError();
-              }
-              return;
-            } else if (uri.startsWith(actionBase + "/") &&
-                       uri.length() > (actionBase.length() + 1)) {
-              if (method == HTTP_GET || method == HTTP_OPTIONS) {
-                handleThingActionIdGet(device, action);
-              } else if (method == HTTP_DELETE) {
-                handleThingActionIdDelete(device, action);
-              } else {
-                handleError();
-              }
-              return;
-            }
-            action = action->next;
-          }
-
-          ThingEvent *event = device->firstEvent;
-          while (event != nullptr) {
-            String eventBase = deviceBase + "/events/" + event->id;
-            if (uri == eventBase) {
-              if (method == HTTP_GET || method == HTTP_OPTIONS) {
-                handleThingEventGet(device, event);
-              } else {
-                handleError();
-              }
-              return;
-            }
-            event = (ThingEvent *)event->next;
-          }
-        }
+    // the router's paths have no leading '/'
+    if (uri[0] != '/' ||
+        !router.dispatch(uri + 1, slot->request.uriLength() - 1, nullptr,
+                         0)) {
+      handleError();
+    }
+  }
+
+  void handleRoute(const Route &route, const ThingRouteMatch &match) {
+    ThingDevice *device = route.device;
+    bool get = method == HTTP_GET || method == HTTP_OPTIONS;
+
+    switch (route.kind) {
+    case ROUTE_THING:
+      if (method == HTTP_GET &&
+          strstr(slot->request.accept(), "text/event-stream") != nullptr) {
+        handleThingStream(device);
+        return;
+      } else if (get) {
+        handleThing(device);
+        return;
+      }
+      break;
+    case ROUTE_PROPERTIES:
+      if (get) {
+        handleThingPropertiesGet(device->firstProperty);
+        return;
+      }
+      break;
+    case ROUTE_ACTIONS:
+      if (get) {
+        handleThingActionsGet(device);
+        return;
+      } else if (method == HTTP_POST) {
+        handleThingActionsPost(device);
+        return;
+      }
+      break;
+    case ROUTE_EVENTS:
+      if (get) {
+        handleThingEventsGet(device);
+        return;
+      }
+      break;
+    case ROUTE_PROPERTY:
+      if (get) {
+        handleThingPropertyGet(device, (ThingProperty *)route.target);
+        return;
+      } else if (method == HTTP_PUT) {
+        handleThingPropertyPut(device, (ThingProperty *)route.target);
+        return;
+      }
+      break;
+    case ROUTE_PROPERTY_HISTORY:
+      if (get) {
+        handleThingPropertyHistoryGet((ThingProperty *)route.target);
+        return;
+      }
+      break;
+    case ROUTE_ACTION:
+      if (get) {
+        handleThingActionGet(device, (ThingAction *)route.target);
+        return;
+      } else if (method == HTTP_POST) {
+        handleThingActionPost(device, (ThingAction *)route.target);
+        return;
+      }
+      break;
+    case ROUTE_ACTION_ID:
+      // the last segment of the path, so NUL terminated
+      if (get) {
+        handleThingActionIdGet(device, match.captures[0]);
+        return;
+      } else if (method == HTTP_DELETE) {
+        handleThingActionIdDelete(device, match.captures[0]);
+        return;
       }
-      device = device->next;
+      break;
+    case ROUTE_EVENT:
+      if (get) {
+        handleThingEventGet(device, (ThingItem *)route.target);
+        return;
+      }
+      break;
     }
     handleError();
   }
 
-  void sendOk() { client.println("HTTP/1.1 200 OK"); }
+  void sendOk() { slot->client.println("HTTP/1.1 200 OK"); }
 
-  void sendCreated() { client.println("HTTP/1.1 201 Created"); }
+  void sendCreated() { slot->client.println("HTTP/1.1 201 Created"); }
 
-  void sendNoContent() { client.println("HTTP/1.1 204 No Content"); }
+  void sendNoContent() { slot->client.println("HTTP/1.1 204 No Content"); }
 
-  void sendHeaders() {
-    client.println("Access-Control-Allow-Origin: *");
-    client.println(
+  /**
+   * streamed: the body is written through a ThingChunkedPrint, see
+   * beginStream(), and its length is not known up front. contentType
+   * overrides that of the negotiated encoding.
+   */
+  void sendHeaders(size_t contentLength, bool streamed = false,
+                   const char *contentType = nullptr) {
+    slot->client.println("Access-Control-Allow-Origin: *");
+    slot->client.println(
         "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS");
-    client.println("Access-Control-Allow-Headers: "
-                   "Origin, X-Requested-With, Content-Type, Accept");
-    client.println("Content-Type: application/json");
-    client.println("Connection: close");
-    client.println();
+    slot->client.println("Access-Control-Allow-Headers: "
+                         "Origin, X-Requested-With, Content-Type, Accept");
+    slot->client.print("Content-Type: ");
+    slot->client.println(contentType != nullptr
+                             ? contentType
+                             : thing_encoding_content_type(encoding));
+    sendEtag();
+    if (!streamed) {
+      slot->client.print("Content-Length: ");
+      slot->client.println((unsigned long)contentLength);
+    } else if (slot->request.http11()) {
+      slot->client.println("Transfer-Encoding: chunked");
+    } else {
+      // an HTTP/1.0 client reads the body up to the end of the connection
+      slot->keepConnection = false;
+    }
+    sendConnection();
   }
 
-  void handleThings() {
-    sendOk();
-    sendHeaders();
+  // ends the headers
+  void sendConnection() {
+    if (slot->keepConnection) {
+      slot->client.println("Connection: keep-alive");
+      slot->client.print("Keep-Alive: timeout=");
+      slot->client.println(keepAliveTimeoutMs / 1000);
+    } else {
+      slot->client.println("Connection: close");
+    }
+    slot->client.println();
+  }
+
+  void sendEtag() {
+    if (etag[0] != '\0') {
+      slot->client.print("ETag: ");
+      slot->client.println(etag);
+      // the representation depends on Accept, see negotiateEncoding()
+      slot->client.println("Vary: Accept");
+    }
+  }
 
-    DynamicJsonDocument buf(LARGE_JSON_DOCUMENT_SIZE);
-    JsonArray things = buf.to<JsonArray>();
-    ThingDevice *device = this->firstDevice;
-    while (device != nullptr) {
-      JsonObject descr = things.createNestedObject();
-      device->serialize(descr, ip, port);
-      descr["href"] = "/things/" + device->id;
-      device = device->next;
+  /**
+   * Makes tag (a hash of the response body or of what it is generated
+   * from) the ETag of the response. If the client already has it, as
+   * told by If-None-Match, answers 304 Not Modified and returns true.
+   */
+  bool notModified(uint32_t tag) {
+    setEtag(tag);
+    if (!clientHasEtag()) {
+      return false;
     }
 
-    serializeJson(things, client);
-    delay(1);
-    client.stop();
+    slot->client.println("HTTP/1.1 304 Not Modified");
+    sendEtag();
+    sendConnection();
+    endResponse();
+    return true;
   }
 
-  void handleThing(ThingDevice *device) {
-    sendOk();
-    sendHeaders();
+  void setEtag(uint32_t tag) {
+    static const char digits[] = "0123456789abcdef";
+    char *p = etag;
+    *p++ = '"';
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      *p++ = digits[(tag >> shift) & 0xf];
+    }
+    if (encoding == THING_ENCODING_MSGPACK) {
+      *p++ = 'm';
+    }
+    *p++ = '"';
+    *p = '\0';
+  }
+
+  // If-None-Match names the ETag set by setEtag()
+  bool clientHasEtag() {
+    if (method != HTTP_GET) {
+      return false;
+    }
+    const char *cached = slot->request.ifNoneMatch();
+    return strcmp(cached, "*") == 0 || strstr(cached, etag) != nullptr;
+  }
+
+  // changes with every new value or timestamp of the properties
+  uint32_t valueTag(ThingItem *item, ThingItem *end) {
+    uint32_t hash = thing_fnv1a(THING_FNV1A_OFFSET, (const uint8_t *)&etagSalt,
+                                sizeof(etagSalt));
+    for (; item != end; item = item->next) {
+      uint32_t version = item->getValueVersion();
+      int64_t timestampMs = item->getTimestamp();
+      hash = thing_fnv1a(hash, (const uint8_t *)&version, sizeof(version));
+      hash = thing_fnv1a(hash, (const uint8_t *)&timestampMs,
+                         sizeof(timestampMs));
+    }
+    return hash;
+  }
 
-    DynamicJsonDocument buf(LARGE_JSON_DOCUMENT_SIZE);
-    JsonObject descr = buf.to<JsonObject>();
-    device->serialize(descr, ip, port);
+  void sendValue(JsonVariantConst value) {
+    sendHeaders(thing_measure(value, encoding));
+    thing_serialize(value, slot->client, encoding);
+    endResponse();
+  }
 
-    serializeJson(descr, client);
+  // closes the connection unless the client may send another request
+  void endResponse() {
+    if (slot->keepConnection) {
+      slot->lastReceivedMs = millis();
+      return;
+    }
     delay(1);
-    client.stop();
+    slot->client.stop();
+  }
+
+  // MessagePack only if the client asks for it, JSON otherwise
+  ThingEncoding negotiateEncoding() {
+    const char *accept = slot->request.accept();
+    if (strstr(accept, "application/msgpack") != nullptr ||
+        strstr(accept, "application/x-msgpack") != nullptr) {
+      return THING_ENCODING_MSGPACK;
+    }
+    return THING_ENCODING_JSON;
   }
 
-  void handleThingPropertyGet(ThingItem *item) {
+  /**
+   * Headers of a 200 response whose body is generated while it is sent;
+   * write the body to the returned print, then call endStream(). Memory
+   * use does not depend on the size of the body.
+   */
+  ThingChunkedPrint beginStream() {
     sendOk();
-    sendHeaders();
+    sendHeaders(0, true);
+    return ThingChunkedPrint(slot->client, slot->request.http11());
+  }
+
+  void endStream(ThingChunkedPrint &out) {
+    out.end();
+    endResponse();
+  }
+
+  void handleThings() {
+    String mac(port);
+    size_t count = 0;
+    uint32_t tag = THING_FNV1A_OFFSET;
+    for (ThingDevice *d = firstDevice; d != nullptr; d = d->next) {
+      uint32_t hash = d->descriptionHash(ip, mac);
+      tag = thing_fnv1a(tag, (const uint8_t *)&hash, sizeof(hash));
+      tag = thing_fnv1a(tag, (const uint8_t *)d->id.c_str(), d->id.length());
+      count++;
+    }
+    if (notModified(tag)) {
+      return;
+    }
+
+    ThingChunkedPrint out = beginStream();
+    if (encoding == THING_ENCODING_MSGPACK) {
+      thing_msgpack_array(out, count);
+    } else {
+      out.write('[');
+    }
+
+    for (ThingDevice *device = firstDevice; device != nullptr;
+         device = device->next) {
+      if (encoding == THING_ENCODING_JSON && device != firstDevice) {
+        out.write(',');
+      }
+      size_t members = encoding == THING_ENCODING_MSGPACK
+                           ? device->descriptionMemberCount(ip, mac) + 1
+                           : 0;
+      ThingObjectWriter descr(out, encoding, members);
+      device->serializeMembers(descr, ip, mac);
+      String href = "/things/" + device->id;
+      descr.member("href", href.c_str());
+      descr.end();
+    }
+
+    if (encoding == THING_ENCODING_JSON) {
+      out.write(']');
+    }
+    endStream(out);
+  }
+
+  void handleThing(ThingDevice *device) {
+    if (notModified(device->descriptionHash(ip, String(port)))) {
+      return;
+    }
+    ThingChunkedPrint out = beginStream();
+    device->serialize(out, ip, String(port), encoding);
+    endStream(out);
+  }
+
+  /**
+   * With ?wait=<seconds> the response is held back until the value
+   * changes, unless If-None-Match shows the client has not seen the
+   * current one yet. After the wait it is 304 if the client's value is
+   * still current, as for any conditional GET.
+   */
+  void handleThingPropertyGet(ThingDevice *device, ThingItem *item) {
+    uint32_t waitMs = waitParam();
+    if (waitMs > 0) {
+      setEtag(valueTag(item, item->next));
+      if (slot->request.ifNoneMatch()[0] == '\0' || clientHasEtag()) {
+        park(PARK_PROPERTY, device, item, waitMs);
+        return;
+      }
+    }
+    sendThingProperty(item);
+  }
+
+  void sendThingProperty(ThingItem *item) {
+    if (notModified(valueTag(item, item->next))) {
+      return;
+    }
 
     DynamicJsonDocument doc(SMALL_JSON_DOCUMENT_SIZE);
     JsonObject prop = doc.to<JsonObject>();
     item->serializeValue(prop);
-    serializeJson(prop, client);
-    delay(1);
-    client.stop();
+    sendOk();
+    sendValue(prop);
   }
 
-  void handleThingActionGet(ThingDevice *device, ThingAction *action) {
+  // ?resolution=raw|1m|15m&since=<epoch ms>
+  void handleThingPropertyHistoryGet(ThingProperty *property) {
+    ThingHistory *history = property->getHistory();
+    if (history == nullptr) {
+      handleError();
+      return;
+    }
+
+    String resolution = queryParam("resolution");
+    String since = queryParam("since");
+
+    ThingHistoryResolution r = ThingHistory::parseResolution(
+        resolution.c_str(), resolution.length());
+    int64_t sinceMs = atoll(since.c_str());
+
     sendOk();
-    sendHeaders();
+    sendHeaders(history->measure(r, sinceMs, encoding));
+    history->print(slot->client, r, sinceMs, encoding);
+    endResponse();
+  }
 
+  String queryParam(const char *name) {
+    size_t nameLen = strlen(name);
+    const char *param = slot->request.query();
+    while (*param != '\0') {
+      const char *end = strchr(param, '&');
+      if (end == nullptr) {
+        end = param + strlen(param);
+      }
+      if ((size_t)(end - param) > nameLen && param[nameLen] == '=' &&
+          strncmp(param, name, nameLen) == 0) {
+        return String(param).substring(nameLen + 1, end - param);
+      }
+      param = *end == '&' ? end + 1 : end;
+    }
+    return "";
+  }
+
+  void handleThingActionGet(ThingDevice *device, ThingAction *action) {
     DynamicJsonDocument doc(LARGE_JSON_DOCUMENT_SIZE);
     JsonArray queue = doc.to<JsonArray>();
     device->serializeActionQueue(queue, action->id);
-    serializeJson(queue, client);
-    delay(1);
-    client.stop();
+    sendOk();
+    sendValue(queue);
   }
 
-  void handleThingActionIdGet(ThingDevice *device, ThingAction *action) {
-    String base = "/things/" + device->id + "/actions/" + action->id;
-    String actionId = uri.substring(base.length() + 1);
-    const char *actionIdC = actionId.c_str();
-    const char *slash = strchr(actionIdC, '/');
-
-    if (slash) {
-      actionId = actionId.substring(0, slash - actionIdC);
-    }
-
-    ThingActionObject *obj = device->findActionObject(actionId.c_str());
+  void handleThingActionIdGet(ThingDevice *device, const char *actionId) {
+    ThingActionObject *obj = device->findActionObject(actionId);
     if (obj == nullptr) {
       handleError();
       return;
     }
 
-    sendOk();
-    sendHeaders();
-
     DynamicJsonDocument doc(SMALL_JSON_DOCUMENT_SIZE);
     JsonObject o = doc.to<JsonObject>();
     obj->serialize(o, device->id);
-    serializeJson(o, client);
-    delay(1);
-    client.stop();
+    sendOk();
+    sendValue(o);
   }
 
-  void handleThingActionIdDelete(ThingDevice *device, ThingAction *action) {
-    String base = "/things/" + device->id + "/actions/" + action->id;
-    String actionId = uri.substring(base.length() + 1);
-    const char *actionIdC = actionId.c_str();
-    const char *slash = strchr(actionIdC, '/');
-
-    if (slash) {
-      actionId = actionId.substring(0, slash - actionIdC);
-    }
-
+  void handleThingActionIdDelete(ThingDevice *device, const char *actionId) {
     device->removeAction(actionId);
     sendNoContent();
-    sendHeaders();
+    sendHeaders(0);
+    endResponse();
   }
 
   void handleThingActionPost(ThingDevice *device, ThingAction *action) {
     DynamicJsonDocument *newBuffer =
         new DynamicJsonDocument(SMALL_JSON_DOCUMENT_SIZE);
-    auto error = deserializeJson(*newBuffer, content);
+    auto error = deserializeJson(*newBuffer, slot->request.body(),
+                                 slot->request.bodyLength());
     if (error) { // unable to parse json
       handleError();
       delete newBuffer;
@@ -549,63 +1013,279 @@ private:
       return;
     }
 
-    sendCreated();
-    sendHeaders();
+    // runs after the response, off this thread where the platform has one
+    if (!executor.submit(obj)) {
+      device->removeAction(obj->id); // also frees newBuffer
+      handleError();
+      return;
+    }
 
     DynamicJsonDocument respBuffer(SMALL_JSON_DOCUMENT_SIZE);
     JsonObject item = respBuffer.to<JsonObject>();
     obj->serialize(item, device->id);
-    serializeJson(item, client);
-    delay(1);
-    client.stop();
-
-    obj->start();
+    sendCreated();
+    sendValue(item);
   }
 
+  /**
+   * The queued occurrences, newest first. With ?wait=<seconds> only those
+   * that occur from now on: the response is held back until there is one
+   * or the wait is over, then it is [].
+   */
   void handleThingEventGet(ThingDevice *device, ThingItem *item) {
-    sendOk();
-    sendHeaders();
+    uint32_t waitMs = waitParam();
+    if (waitMs > 0) {
+      park(PARK_EVENT, device, item, waitMs);
+      return;
+    }
 
     DynamicJsonDocument doc(SMALL_JSON_DOCUMENT_SIZE);
     JsonArray queue = doc.to<JsonArray>();
     device->serializeEventQueue(queue, item->id);
-    serializeJson(queue, client);
-    delay(1);
-    client.stop();
+    sendOk();
+    sendValue(queue);
   }
 
-  void handleThingPropertiesGet(ThingItem *rootItem) {
+  // ?wait=<seconds> of a GET, at most THING_HTTP_LONGPOLL_TIMEOUT_MS
+  uint32_t waitParam() {
+    if (method != HTTP_GET) {
+      return 0;
+    }
+    unsigned long seconds = strtoul(queryParam("wait").c_str(), nullptr, 10);
+    return seconds < THING_HTTP_LONGPOLL_TIMEOUT_MS / 1000
+               ? seconds * 1000
+               : THING_HTTP_LONGPOLL_TIMEOUT_MS;
+  }
+
+  /**
+   * A text/event-stream that stays open: a "propertyStatus" message with
+   * the value of every property that changes and an "event" message for
+   * every event queued, as the Web Thing WebSocket messages of those
+   * types. Values changing faster than update() runs are coalesced.
+   */
+  void handleThingStream(ThingDevice *device) {
+    if (!park(PARK_STREAM, device, nullptr, 0)) {
+      return;
+    }
+    scanChanges();
+    slot->parkVersion = changeSeq;
+    // the response never ends
+    slot->keepConnection = false;
     sendOk();
-    sendHeaders();
+    slot->client.println("Cache-Control: no-cache");
+    sendHeaders(0, true, "text/event-stream");
+    ThingChunkedPrint out(slot->client, slot->request.http11());
+    // the client reconnects after this many ms if the stream breaks
+    out.print("retry: 3000\n\n");
+    out.sendBuffer();
+  }
 
-    DynamicJsonDocument doc(LARGE_JSON_DOCUMENT_SIZE);
-    JsonObject prop = doc.to<JsonObject>();
-    ThingItem *item = rootItem;
-    while (item != nullptr) {
-      item->serializeValue(prop);
-      item = item->next;
+  /**
+   * Holds the response to the current request back; serviceParked()
+   * sends it. Answers 503 instead if THING_HTTP_PARKED_SLOTS are taken.
+   */
+  bool park(HTTPParkKind kind, ThingDevice *device, ThingItem *item,
+            uint32_t timeoutMs) {
+    size_t parked = 0;
+    for (size_t i = 0; i < THING_HTTP_SLOTS; i++) {
+      parked += slots[i].client && slots[i].park != PARK_NONE;
     }
-    serializeJson(prop, client);
-    delay(1);
-    client.stop();
+    if (parked >= THING_HTTP_PARKED_SLOTS) {
+      handleStatus(503);
+      return false;
+    }
+
+    slot->park = kind;
+    slot->parkDevice = device;
+    slot->parkItem = item;
+    slot->parkVersion = item != nullptr ? item->getValueVersion() : 0;
+    slot->parkEvents = device->getEventQueueStats().queued;
+    slot->parkedMs = millis();
+    slot->parkTimeoutMs = timeoutMs;
+    return true;
   }
 
-  void handleThingActionsGet(ThingDevice *device) {
+  /**
+   * Sends what a parked slot waits for if it is there. Returns true once
+   * the response is complete, so the slot takes requests again. Costs a
+   * few comparisons while nothing changes.
+   */
+  bool serviceParked() {
+    uint32_t now = millis();
+    if (slot->park == PARK_STREAM) {
+      pushChanges(now);
+      return false;
+    }
+
+    bool timedOut = now - slot->parkedMs >= slot->parkTimeoutMs;
+    ThingItem *item = slot->parkItem;
+    if (slot->park == PARK_PROPERTY) {
+      if (item->getValueVersion() == slot->parkVersion && !timedOut) {
+        return false;
+      }
+    } else {
+      size_t first = firstNewEvent();
+      size_t count = 0;
+      for (size_t i = first; i < slot->parkDevice->eventQueue.size(); i++) {
+        count += slot->parkDevice->eventQueue.at(i)->name == item->id;
+      }
+      if (count == 0 && !timedOut) {
+        slot->parkEvents = slot->parkDevice->getEventQueueStats().queued;
+        return false;
+      }
+    }
+
+    // as for the request that parked
+    HTTPParkKind kind = slot->park;
+    slot->park = PARK_NONE;
+    method = HTTP_GET;
+    etag[0] = '\0';
+    encoding = negotiateEncoding();
+    if (kind == PARK_PROPERTY) {
+      sendThingProperty(item);
+      return true;
+    }
+
+    ThingQueue<ThingEventObject, THING_EVENT_QUEUE_CAPACITY> &queue =
+        slot->parkDevice->eventQueue;
+    size_t first = firstNewEvent();
+    DynamicJsonDocument doc(SMALL_JSON_DOCUMENT_SIZE);
+    JsonArray events = doc.to<JsonArray>();
+    for (size_t i = queue.size(); i-- > first;) {
+      if (queue.at(i)->name == item->id) {
+        queue.at(i)->serialize(events.createNestedObject());
+      }
+    }
     sendOk();
-    sendHeaders();
+    sendValue(events);
+    return true;
+  }
 
-    DynamicJsonDocument doc(LARGE_JSON_DOCUMENT_SIZE);
-    JsonArray queue = doc.to<JsonArray>();
-    device->serializeActionQueue(queue);
-    serializeJson(queue, client);
-    delay(1);
-    client.stop();
+  // index of the first event queued on the parked device since parkEvents
+  size_t firstNewEvent() {
+    ThingDevice *device = slot->parkDevice;
+    uint32_t added = device->getEventQueueStats().queued - slot->parkEvents;
+    size_t size = device->eventQueue.size();
+    return added < size ? size - added : 0;
+  }
+
+  /**
+   * Numbers every property whose value changed since the last scan with
+   * the next changeSeq, so each stream can tell which ones it has not
+   * sent yet. Runs once per update() while a stream is open.
+   */
+  void scanChanges() {
+    for (size_t i = 0; i < routeCount; i++) {
+      Route &route = routes[i];
+      if (route.kind != ROUTE_PROPERTY) {
+        continue;
+      }
+      uint32_t version = ((ThingItem *)route.target)->getValueVersion();
+      if (version != route.version) {
+        route.version = version;
+        route.changed = ++changeSeq;
+      }
+    }
+  }
+
+  // writes the stream's new messages, or a heartbeat once in a while
+  void pushChanges(uint32_t now) {
+    ThingDevice *device = slot->parkDevice;
+    uint32_t queued = device->getEventQueueStats().queued;
+    bool properties = changeSeq != slot->parkVersion;
+    bool events = queued != slot->parkEvents;
+    if (!properties && !events &&
+        now - slot->parkedMs < THING_HTTP_SSE_HEARTBEAT_MS) {
+      return;
+    }
+
+    ThingChunkedPrint out(slot->client, slot->request.http11());
+    DynamicJsonDocument doc(SMALL_JSON_DOCUMENT_SIZE);
+    if (properties) {
+      for (size_t i = 0; i < routeCount; i++) {
+        Route &route = routes[i];
+        if (route.kind == ROUTE_PROPERTY && route.device == device &&
+            route.changed > slot->parkVersion) {
+          doc.clear();
+          ((ThingItem *)route.target)->serializeValue(doc.to<JsonObject>());
+          printMessage(out, "propertyStatus", doc);
+        }
+      }
+    }
+    if (events) {
+      for (size_t i = firstNewEvent(); i < device->eventQueue.size(); i++) {
+        doc.clear();
+        device->eventQueue.at(i)->serialize(doc.to<JsonObject>());
+        printMessage(out, "event", doc);
+      }
+    }
+    if (!properties && !events) {
+      // lets the client and proxies know the stream is alive
+      out.print(":\n\n");
+    }
+    out.sendBuffer();
+
+    slot->parkVersion = changeSeq;
+    slot->parkEvents = queued;
+    slot->parkedMs = now;
+  }
+
+  // one text/event-stream message; JSON has no line breaks to escape
+  static void printMessage(Print &out, const char *type,
+                           JsonVariantConst data) {
+    out.print("event: ");
+    out.print(type);
+    out.print("\ndata: ");
+    thing_serialize(data, out, THING_ENCODING_JSON);
+    out.print("\n\n");
+  }
+
+  /**
+   * {"time": ..., "<id>": value, ...}, one member per property written as
+   * it is serialized; "time" is that of the last property, as when all
+   * values were collected in one object.
+   */
+  void handleThingPropertiesGet(ThingItem *rootItem) {
+    size_t count = 0;
+    ThingItem *last = nullptr;
+    for (ThingItem *item = rootItem; item != nullptr; item = item->next) {
+      count += item->type != NO_STATE;
+      last = item;
+    }
+
+    if (notModified(valueTag(rootItem, nullptr))) {
+      return;
+    }
+
+    ThingChunkedPrint out = beginStream();
+    ThingObjectWriter values(out, encoding, count + (last != nullptr));
+    DynamicJsonDocument doc(SMALL_JSON_DOCUMENT_SIZE);
+    if (last != nullptr) {
+      last->serializeValue(doc.to<JsonObject>());
+      values.member("time", doc["time"].as<const char *>());
+    }
+    for (ThingItem *item = rootItem; item != nullptr; item = item->next) {
+      doc.clear();
+      JsonObject prop = doc.to<JsonObject>();
+      item->serializeValue(prop);
+      prop.remove("time");
+      values.members(prop);
+    }
+    values.end();
+    endStream(out);
+  }
+
+  void handleThingActionsGet(ThingDevice *device) {
+    ThingChunkedPrint out = beginStream();
+    device->printActionQueue(out, encoding);
+    endStream(out);
   }
 
   void handleThingActionsPost(ThingDevice *device) {
     DynamicJsonDocument *newBuffer =
         new DynamicJsonDocument(SMALL_JSON_DOCUMENT_SIZE);
-    auto error = deserializeJson(*newBuffer, content);
+    auto error = deserializeJson(*newBuffer, slot->request.body(),
+                                 slot->request.bodyLength());
     if (error) { // unable to parse json
       handleError();
       delete newBuffer;
@@ -628,34 +1308,30 @@ private:
       return;
     }
 
-    sendCreated();
-    sendHeaders();
+    // runs after the response, off this thread where the platform has one
+    if (!executor.submit(obj)) {
+      device->removeAction(obj->id); // also frees newBuffer
+      handleError();
+      return;
+    }
 
     DynamicJsonDocument respBuffer(SMALL_JSON_DOCUMENT_SIZE);
     JsonObject item = respBuffer.to<JsonObject>();
     obj->serialize(item, device->id);
-    serializeJson(item, client);
-    delay(1);
-    client.stop();
-
-    obj->start();
+    sendCreated();
+    sendValue(item);
   }
 
   void handleThingEventsGet(ThingDevice *device) {
-    sendOk();
-    sendHeaders();
-
-    DynamicJsonDocument doc(LARGE_JSON_DOCUMENT_SIZE);
-    JsonArray queue = doc.to<JsonArray>();
-    device->serializeEventQueue(queue);
-    serializeJson(queue, client);
-    delay(1);
-    client.stop();
+    ThingChunkedPrint out = beginStream();
+    device->printEventQueue(out, encoding);
+    endStream(out);
   }
 
   void handleThingPropertyPut(ThingDevice *device, ThingProperty *property) {
     DynamicJsonDocument newBuffer(SMALL_JSON_DOCUMENT_SIZE);
-    auto error = deserializeJson(newBuffer, content);
+    auto error = deserializeJson(newBuffer, slot->request.body(),
+                                 slot->request.bodyLength());
     if (error) { // unable to parse json
       handleError();
       return;
@@ -670,29 +1346,28 @@ private:
     device->setProperty(property->id.c_str(), newProp[property->id]);
 
     sendOk();
-    sendHeaders();
-
-    serializeJson(newProp, client);
-    delay(1);
-    client.stop();
+    sendValue(newProp);
   }
 
-  void handleError() {
-    client.println("HTTP/1.1 400 Bad Request");
-    sendHeaders();
-    delay(1);
-    client.stop();
+  void handleError() { handleStatus(400); }
+
+  // also for requests that could not be parsed, so the connection ends
+  void handleStatus(int status) {
+    slot->keepConnection = false;
+    slot->client.print("HTTP/1.1 ");
+    slot->client.print(status);
+    slot->client.print(' ');
+    slot->client.println(thing_http_reason(status));
+    sendHeaders(0);
+    endResponse();
   }
 
   void resetParser() {
-    state = STATE_READ_METHOD;
     method = HTTP_ANY;
-    methodRaw = "";
-    headerRaw = "";
-    host = "";
-    uri = "";
-    content = "";
-    retries = 0;
+    slot->request.reset();
+    slot->requests = 0;
+    slot->keepConnection = false;
+    slot->park = PARK_NONE;
   }
 };
 
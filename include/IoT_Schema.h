@@ -1,6 +1,8 @@
 #ifndef IOT_SCHEMA_H
 #define IOT_SCHEMA_H
 
+#include <stdint.h>
+
 static const char *iot_schema_data_string[] = {
     "VoltageData",
     "ActiveEnergyData",
@@ -29,6 +31,35 @@ static const char *iot_schema_data_type_title[] = {
     "power",
     "reactive power"};
 
+// default reporting policy per data type (see ThingReportingPolicy)
+static const double iot_schema_data_type_deadband[] = {
+    0,  // Volt, relative only
+    1,  // WattHour, cumulative counter
+    0,
+    0,
+    0};
+
+static const double iot_schema_data_type_relative_deadband[] = {
+    0.01,
+    0,
+    0.02,
+    0.02,
+    0.02};
+
+static const uint32_t iot_schema_data_type_min_interval_ms[] = {
+    5000,
+    1000,
+    5000,
+    5000,
+    5000};
+
+static const uint32_t iot_schema_data_type_heartbeat_ms[] = {
+    900000,
+    900000,
+    900000,
+    900000,
+    900000};
+
 static const char *om_data_string[] = {
     "Angle",
 };
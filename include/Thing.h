@@ -18,13 +18,23 @@
 #if !defined(WITHOUT_WS) && (defined(ESP8266) || defined(ESP32))
 #include <ESPAsyncWebServer.h>
 // #include <ESPRandom.h>
-#include "IoT_Schema.h"
 #endif
 
+#include "IoT_Schema.h"
+
 #include "mqtt_client.h"
 
 #define ARDUINOJSON_USE_LONG_LONG 1
 #include <ArduinoJson.h>
+#include <atomic>
+
+#include "ThingHistory.h"
+#include "ThingIndex.h"
+#include "ThingMQTTOutbox.h"
+#include "ThingPlatform.h"
+#include "ThingQueue.h"
+#include "ThingReporting.h"
+#include "ThingStream.h"
 
 #ifndef LARGE_JSON_DOCUMENT_SIZE
 #ifdef LARGE_JSON_BUFFERS
@@ -42,7 +52,70 @@
 #endif
 #endif
 
+// value publishes are formatted into a stack buffer of this size
+#ifndef THING_PAYLOAD_BUFFER_SIZE
+#define THING_PAYLOAD_BUFFER_SIZE 128
+#endif
+
+// device snapshots on things/<MAC>/state are split when they exceed this
+#ifndef THING_SNAPSHOT_BUFFER_SIZE
+#define THING_SNAPSHOT_BUFFER_SIZE 512
+#endif
+
+// holds one property/action/event (or the header) of a streamed TD
+#ifndef TD_ITEM_JSON_DOCUMENT_SIZE
+#ifdef LARGE_JSON_BUFFERS
+#define TD_ITEM_JSON_DOCUMENT_SIZE 2048
+#else
+#define TD_ITEM_JSON_DOCUMENT_SIZE 1024
+#endif
+#endif
+
+// per device; a full queue drops its oldest finished entry (or rejects)
+#ifndef THING_ACTION_QUEUE_CAPACITY
+#define THING_ACTION_QUEUE_CAPACITY 8
+#endif
+
+#ifndef THING_EVENT_QUEUE_CAPACITY
+#define THING_EVENT_QUEUE_CAPACITY 16
+#endif
+
+// object pools shared by all devices, new returns nullptr when exhausted.
+// The defaults hold two full queues, so with more devices one busy device
+// can take every object; a gateway that must not let that happen sets
+// these to its device count times the queue capacity.
+#ifndef THING_ACTION_POOL_SIZE
+#define THING_ACTION_POOL_SIZE (2 * THING_ACTION_QUEUE_CAPACITY)
+#endif
+
+#ifndef THING_EVENT_POOL_SIZE
+#define THING_EVENT_POOL_SIZE (2 * THING_EVENT_QUEUE_CAPACITY)
+#endif
+
 esp_mqtt_client_handle_t mqtt_client;
+// set by ThingMQTTAdapter::begin(), publishes go straight to the client until then
+ThingMQTTOutbox *mqtt_outbox = nullptr;
+// store-and-forward hook, set when ThingMQTTAdapter::enableJournal() was called
+bool (*mqtt_journal_append)(const char *topic, const char *payload, size_t len) = nullptr;
+
+/**
+ * Every publish goes through here. With an outbox the call only copies the
+ * message and never waits for the network; false means it was dropped.
+ * While disconnected, QoS1 messages are also journaled, as the outbox only
+ * keeps the latest message per topic; the outbox tells the journal which
+ * of them it delivered, so they are not replayed again.
+ */
+inline bool thing_mqtt_publish(const char *topic, const char *payload, size_t len, int qos,
+                               bool retain)
+{
+  if (mqtt_outbox != nullptr)
+  {
+    bool journaled = qos > 0 && mqtt_journal_append != nullptr && !mqtt_outbox->isConnected() &&
+                     mqtt_journal_append(topic, payload, len);
+    return mqtt_outbox->enqueue(topic, payload, len, qos, retain, journaled);
+  }
+  return esp_mqtt_client_publish(mqtt_client, topic, payload, len, qos, retain) >= 0;
+}
 
 enum ThingDataType
 {
@@ -72,22 +145,60 @@ private:
 public:
   String name;
   DynamicJsonDocument *actionRequest = nullptr;
-  String timeRequested;
-  String timeCompleted;
-  String status;
+  // ISO 8601, timeCompleted is empty until the action has finished
+  char timeRequested[26];
+  char timeCompleted[26] = "";
+  // created, pending, executing, completed or cancelled; always a literal,
+  // so it can be read while the executor task updates it
+  std::atomic<const char *> status{"created"};
   String id;
-  ThingActionObject *next = nullptr;
+  // set by cancel(); a long running start_fn should poll it and return early
+  volatile bool cancelRequested = false;
 
   ThingActionObject(const char *name_, DynamicJsonDocument *actionRequest_,
                     void (*start_fn_)(const JsonVariant &),
                     void (*cancel_fn_)())
       : start_fn(start_fn_), cancel_fn(cancel_fn_), name(name_),
-        actionRequest(actionRequest_),
-        timeRequested("1970-01-01T00:00:00+00:00"), status("created")
+        actionRequest(actionRequest_)
   {
+    thing_format_iso8601(timeRequested, thing_epoch_ms());
     generateId();
   }
 
+  // allocated from a fixed pool, so `new` yields nullptr once it is empty
+  static void *operator new(size_t) noexcept { return pool().allocate(); }
+
+  static void operator delete(void *p) { pool().release(p); }
+
+  static ThingPool<ThingActionObject, THING_ACTION_POOL_SIZE> &pool()
+  {
+    static ThingPool<ThingActionObject, THING_ACTION_POOL_SIZE> p;
+    return p;
+  }
+
+  /**
+   * The device queue and, while the action is pending or executing, the
+   * executor each hold a reference; the last release() frees the object
+   * and its request.
+   */
+  void retain() { refs++; }
+
+  void release()
+  {
+    if (--refs == 0)
+    {
+      delete actionRequest;
+      delete this;
+    }
+  }
+
+  bool isFinished()
+  {
+    // timeCompleted is written before the final status is stored
+    const char *s = status;
+    return strcmp(s, "completed") == 0 || strcmp(s, "cancelled") == 0;
+  }
+
   void generateId()
   {
     for (uint8_t i = 0; i < 16; ++i)
@@ -111,10 +222,10 @@ public:
     JsonObject actionObj = actionRequest->as<JsonObject>();
     data["input"] = actionObj;
 
-    data["status"] = status;
+    data["status"] = status.load();
     data["timeRequested"] = timeRequested;
 
-    if (timeCompleted != "")
+    if (isFinished())
     {
       data["timeCompleted"] = timeCompleted;
     }
@@ -127,29 +238,51 @@ public:
     status = s;
   }
 
+  // Runs the action on the calling thread, see ThingActionExecutor.
   void start()
   {
     setStatus("pending");
+    execute();
+  }
+
+  // pending -> executing -> completed, or cancelled if cancel() came first
+  void execute()
+  {
+    if (cancelRequested)
+    {
+      finish("cancelled");
+      return;
+    }
 
+    setStatus("executing");
     JsonObject actionObj = actionRequest->as<JsonObject>();
     start_fn(actionObj);
 
-    finish();
+    finish(cancelRequested ? "cancelled" : "completed");
   }
 
+  // Cooperative: flags the request and lets cancel_fn stop a running start_fn.
   void cancel()
   {
+    if (isFinished())
+    {
+      return;
+    }
+    cancelRequested = true;
     if (cancel_fn != nullptr)
     {
       cancel_fn();
     }
   }
 
-  void finish()
+  void finish(const char *finalStatus = "completed")
   {
-    timeCompleted = "1970-01-01T00:00:00+00:00";
-    setStatus("completed");
+    thing_format_iso8601(timeCompleted, thing_epoch_ms());
+    setStatus(finalStatus);
   }
+
+private:
+  std::atomic<int> refs{1};
 };
 
 class ThingItem
@@ -193,56 +326,79 @@ public:
   // constructor with all fields (more parameters can be added here)
   ThingItem(const char *id_, const char *title_, const char *description_, ThingDataType type_,
             const char *objectType_, const char *atType_, const char *unit_, double minimum_, double maximum_, bool readOnly_)
-      : id(id_), title(title_), description(description_), type(type_), objectType(objectType_), atType(atType_), unit(unit_), minimum(minimum_), maximum(maximum_), readOnly(readOnly_) {}
+      : id(id_), title(title_), description(description_), type(type_), objectType(objectType_), atType(atType_), unit(unit_), minimum(minimum_), maximum(maximum_), readOnly(readOnly_)
+  {
+    // previous fixed deadbands, override with setReportingPolicy()
+    if (type == NUMBER)
+    {
+      reporter.policy.deadband = 0.5;
+    }
+    else if (type == INTEGER)
+    {
+      reporter.policy.deadband = 1;
+    }
+  }
+
+  void setReportingPolicy(const ThingReportingPolicy &policy)
+  {
+    reporter.policy = policy;
+  }
+
+  const ThingReportingPolicy &getReportingPolicy() { return reporter.policy; }
+
+  /**
+   * Keeps a fixed-size history of this (numeric) property, about 7 kB of
+   * RAM with the default capacities. Samples are recorded whether or not
+   * they are published.
+   */
+  void enableHistory()
+  {
+    if (history == nullptr && type != NO_STATE && type != STRING)
+    {
+      history = new ThingHistory();
+    }
+  }
+
+  ThingHistory *getHistory() { return history; }
 
   void setValue(ThingDataValue newValue)
   {
+    setValue(newValue, thing_epoch_ms());
+  }
+
+  /**
+   * Stores the new value, acquired at acquiredMs (epoch milliseconds, see
+   * thing_timer_to_epoch_ms() for samples stamped in an ISR), and marks it
+   * for publishing if the reporting policy considers it significant (see
+   * ThingReporter).
+   */
+  void setValue(ThingDataValue newValue, int64_t acquiredMs)
+  {
+    uint32_t now = millis();
+    this->timestampMs = acquiredMs;
+    if (differs(newValue))
+    {
+      this->valueVersion++;
+    }
+
     switch (type)
     {
     case NO_STATE:
       break;
     case BOOLEAN:
-    {
-      bool current_boolean = this->getValue().boolean;
-      if (current_boolean != newValue.boolean)
-      {
-        // Serial.println("Boolean value changed");
-        this->value = newValue;
-        this->hasChanged = true;
-      }
-      else
-      {
-        this->hasChanged = false;
-      }
-    }
-    break;
     case NUMBER:
-    {
-      double diff = newValue.number - this->getValue().number;
-      if (abs(diff) >= 0.5)
-      {
-        // Serial.println("Number value changed");
-        this->value = newValue;
-        this->hasChanged = true;
-      }
-      else
-      {
-        this->hasChanged = false;
-      }
-    }
-    break;
     case INTEGER:
     {
-      int diff = newValue.integer - this->getValue().integer;
-      if (abs(diff) >= 1)
+      this->value = newValue;
+      double v = numericValue();
+      if (history != nullptr)
       {
-        // Serial.println("Integer value changed");
-        this->value = newValue;
-        this->hasChanged = true;
+        history->record(acquiredMs, v);
       }
-      else
+      this->hasChanged = reporter.evaluate(v, now);
+      if (this->hasChanged)
       {
-        this->hasChanged = false;
+        reporter.reported(v, now);
       }
     }
     break;
@@ -250,6 +406,7 @@ public:
     {
       this->value = newValue;
       this->hasChanged = true;
+      reporter.reported(0, now);
     }
     break;
     }
@@ -257,8 +414,30 @@ public:
 
   void setValue(const char *s)
   {
-    *(this->getValue().string) = s;
+    String *current = this->getValue().string;
+    if (*current != s)
+    {
+      *current = s;
+      this->valueVersion++;
+    }
+    this->timestampMs = thing_epoch_ms();
+    this->hasChanged = true;
+    reporter.reported(0, millis());
+  }
+
+  /**
+   * Marks the current value for publishing if a held back change or a
+   * heartbeat is due. Returns true in that case.
+   */
+  bool pollReporting(uint32_t now)
+  {
+    if (type == NO_STATE || !reporter.poll(now))
+    {
+      return false;
+    }
+    reporter.reported(numericValue(), now);
     this->hasChanged = true;
+    return true;
   }
 
   /**
@@ -422,18 +601,23 @@ public:
     JsonArray op = inline_links_prop.createNestedArray("op");
     op.add("subscribeevent");
     // inline_links_prop["op"] = "subscribeevent";
-    inline_links_prop["href"] = "/things/" + deviceId + "/actions/" + id;
+    // held until the next occurrence, see WebThingAdapter
+    inline_links_prop["href"] = "/things/" + deviceId + "/events/" + id + "?wait=30";
     inline_links_prop["subprotocol"] = "longpoll";
   }
 
+  // acquisition time of the current value in epoch milliseconds
+  int64_t getTimestamp() { return this->timestampMs; }
+
+  // bumped by every setValue() that changes the value, e.g. for HTTP ETags
+  // and long polls; a new sample of the same value only moves the timestamp
+  uint32_t getValueVersion() { return this->valueVersion; }
+
   void serializeValue(JsonObject prop)
   {
-    time_t timestamp;
-    time(&timestamp);
-    int time_str = timestamp;
-
-    String time = String(time_str);
-    prop["time"] = time;
+    char time[24];
+    time[thing_format_int64(time, this->timestampMs)] = '\0';
+    prop["time"] = (char *)time; // char * makes ArduinoJson copy it
     switch (this->type)
     {
     case NO_STATE:
@@ -453,9 +637,97 @@ public:
     }
   }
 
+  /**
+   * Writes the current value as a JSON literal (or MessagePack value)
+   * without going through a JsonDocument.
+   */
+  void printValue(Print &out, ThingEncoding encoding = THING_ENCODING_JSON)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      switch (this->type)
+      {
+      case NO_STATE:
+        thing_msgpack_nil(out);
+        break;
+      case BOOLEAN:
+        thing_msgpack_bool(out, this->getValue().boolean);
+        break;
+      case NUMBER:
+        thing_msgpack_double(out, this->getValue().number);
+        break;
+      case INTEGER:
+        thing_msgpack_int(out, this->getValue().integer);
+        break;
+      case STRING:
+        thing_msgpack_str(out, this->getValue().string->c_str(), this->getValue().string->length());
+        break;
+      }
+      return;
+    }
+
+    char digits[32];
+    switch (this->type)
+    {
+    case NO_STATE:
+      out.print("null");
+      break;
+    case BOOLEAN:
+      out.print(this->getValue().boolean ? "true" : "false");
+      break;
+    case NUMBER:
+      out.write((const uint8_t *)digits, thing_format_double(digits, this->getValue().number));
+      break;
+    case INTEGER:
+      out.write((const uint8_t *)digits, thing_format_int64(digits, this->getValue().integer));
+      break;
+    case STRING:
+      thing_write_json_string(out, this->getValue().string->c_str());
+      break;
+    }
+  }
+
 private:
   ThingDataValue value = {false};
+  int64_t timestampMs = 0;
+  uint32_t valueVersion = 0;
   bool hasChanged = false;
+  ThingReporter reporter;
+  ThingHistory *history = nullptr;
+
+  // a string changed in place through the stored pointer counts as changed
+  bool differs(ThingDataValue newValue)
+  {
+    switch (type)
+    {
+    case BOOLEAN:
+      return newValue.boolean != value.boolean;
+    case NUMBER:
+      return newValue.number != value.number;
+    case INTEGER:
+      return newValue.integer != value.integer;
+    case STRING:
+      return newValue.string == value.string || newValue.string == nullptr || value.string == nullptr ||
+             *newValue.string != *value.string;
+    default:
+      return false;
+    }
+  }
+
+  double numericValue()
+  {
+    switch (type)
+    {
+    case BOOLEAN:
+      return value.boolean ? 1 : 0;
+    case NUMBER:
+      return value.number;
+    case INTEGER:
+      return (double)value.integer;
+    default:
+      return 0;
+    }
+  }
 };
 
 class ThingProperty : public ThingItem
@@ -468,6 +740,18 @@ public:
   bool observable = false;
   String object_Description = "";
   String devID = "";
+  // cached by setTopicBase() when the property is attached to a device
+  String topic = "";
+  String payloadKey = "";
+  ThingEncoding encoding = THING_ENCODING_JSON;
+  // short numeric id assigned by ThingDevice::addProperty(), used on the
+  // wire instead of the topic and key when compact is set
+  uint16_t alias = 0;
+  bool compact = false;
+  // set by ThingDevice::setBatching()
+  bool publishOwnTopic = true;
+  bool batched = false;
+  bool snapshotPending = false;
 
   ThingProperty(const char *id_, const char *description_, ThingDataType type_,
                 const char *objectType_, const char *atType_,
@@ -487,7 +771,18 @@ public:
   ThingProperty(const char *id_, const char *description_, ThingDataType type_,
                 IOT_SCHEMA iot_, double minimum_, double maximum_, bool readOnly_,
                 void (*callback_)(ThingPropertyValue) = nullptr)
-      : ThingItem(id_, iot_schema_data_type_title[iot_.propertyType], iot_schema_data_type_description[iot_.propertyType], type_, iot_.capability_Name, iot_schema_data_string[iot_.propertyType], iot_schema_data_type_unit[iot_.propertyType], minimum_, maximum_, readOnly_), object_Description(description_), callback(callback_) {}
+      : ThingItem(id_, iot_schema_data_type_title[iot_.propertyType], iot_schema_data_type_description[iot_.propertyType], type_, iot_.capability_Name, iot_schema_data_string[iot_.propertyType], iot_schema_data_type_unit[iot_.propertyType], minimum_, maximum_, readOnly_), object_Description(description_), callback(callback_)
+  {
+    ThingReportingPolicy policy;
+    policy.deadband = iot_schema_data_type_deadband[iot_.propertyType];
+    policy.relativeDeadband = iot_schema_data_type_relative_deadband[iot_.propertyType];
+    policy.minIntervalMs = iot_schema_data_type_min_interval_ms[iot_.propertyType];
+    policy.maxIntervalMs = iot_schema_data_type_heartbeat_ms[iot_.propertyType];
+    setReportingPolicy(policy);
+  }
+
+  // has a callback, so values set remotely are applied
+  bool isWritable() const { return callback != nullptr; }
 
   void serialize(JsonObject obj, String ip_addr, String deviceId)
   {
@@ -498,7 +793,7 @@ public:
     // time properties
     JsonObject time = inner_properties.createNestedObject("time");
     time["title"] = "Date time";
-    time["description"] = "the date time in ISO 8601 format";
+    time["description"] = "acquisition time in milliseconds since the Unix epoch";
     time["type"] = "string";
     time["instanceOf"] = "org.ict.model.wot.dataschema.StringSchema";
     JsonArray at_Type = time.createNestedArray("@type");
@@ -555,8 +850,20 @@ public:
     JsonObject inline_links_prop = inline_links.createNestedObject();
     JsonArray op = inline_links_prop.createNestedArray("op");
     op.add("subscribeevent");
-    inline_links_prop["href"] = ip_addr + ":1883/things/" + deviceId + "/properties/" + id;
-    inline_links_prop["contentType"] = "application/json";
+    inline_links_prop["contentType"] = thing_encoding_content_type(encoding);
+    if (compact)
+    {
+      // values arrive as [time, value] on t/<thing>/<alias>
+      inline_links_prop["href"] = ip_addr + ":1883/t/" + deviceId + "/" + alias + thing_encoding_topic_suffix(encoding);
+      inline_links_prop["mqv:alias"] = alias;
+      JsonArray fields = inline_links_prop.createNestedArray("mqv:fields");
+      fields.add("time");
+      fields.add(id);
+    }
+    else
+    {
+      inline_links_prop["href"] = ip_addr + ":1883/things/" + deviceId + "/properties/" + id + thing_encoding_topic_suffix(encoding);
+    }
 
     // if (callback != nullptr)
     // {
@@ -570,21 +877,151 @@ public:
     // }
   }
 
+  /**
+   * Precomputes the publish topic and the `,"<id>":` payload fragment so
+   * hasChanged() does not build any Strings. In compact mode these are
+   * <compactBase>/<alias> and `,"<alias>":`.
+   */
+  void setTopicBase(const String &base, const String &compactBase = "")
+  {
+    if (compact && compactBase.length() > 0)
+    {
+      topic = compactBase + "/" + alias + thing_encoding_topic_suffix(encoding);
+      payloadKey = String(",\"") + alias + "\":";
+      return;
+    }
+
+    topic = base + "/properties/" + id + thing_encoding_topic_suffix(encoding);
+
+    payloadKey = ",";
+    ThingStringPrint key(payloadKey);
+    thing_write_json_string(key, id.c_str());
+    payloadKey += ':';
+  }
+
+  /**
+   * Formats {"time":"<epoch ms>","<id>":<value>} into buffer, as JSON or
+   * as a two entry MessagePack map; in compact mode the positional
+   * [<epoch ms>,<value>] instead. Returns the payload length or 0 if it
+   * does not fit.
+   */
+  size_t formatPayload(char *buffer, size_t capacity)
+  {
+    ThingBufferPrint out(buffer, capacity);
+    if (compact)
+    {
+      printCompact(out);
+      return out.overflow() ? 0 : out.length();
+    }
+
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_map(out, 2);
+    }
+    else
+    {
+      out.write('{');
+    }
+    printTimeMember(out, encoding, getTimestamp());
+    printValueMember(out);
+    if (encoding == THING_ENCODING_JSON)
+    {
+      out.write('}');
+    }
+
+    return out.overflow() ? 0 : out.length();
+  }
+
+  // `"time":"<epoch ms>"`, the first member of a value or snapshot payload
+  static void printTimeMember(Print &out, ThingEncoding encoding, int64_t timestampMs)
+  {
+    char digits[24];
+    size_t len = thing_format_int64(digits, timestampMs);
+
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_str(out, "time", 4);
+      thing_msgpack_str(out, digits, len);
+      return;
+    }
+
+    out.print("\"time\":\"");
+    out.write((const uint8_t *)digits, len);
+    out.write('"');
+  }
+
+  // `[<epoch ms>,<value>]`, the time as a number rather than a string
+  void printCompact(Print &out)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_array(out, 2);
+      thing_msgpack_int(out, getTimestamp());
+      printValue(out, encoding);
+      return;
+    }
+
+    char digits[24];
+    out.write('[');
+    out.write((const uint8_t *)digits, thing_format_int64(digits, getTimestamp()));
+    out.write(',');
+    printValue(out, encoding);
+    out.write(']');
+  }
+
+  // `,"<id>":<value>`, follows printTimeMember() or another value member
+  void printValueMember(Print &out)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      if (compact)
+      {
+        thing_msgpack_int(out, alias);
+      }
+      else
+      {
+        thing_msgpack_str(out, id.c_str(), id.length());
+      }
+    }
+    else
+    {
+      out.write((const uint8_t *)payloadKey.c_str(), payloadKey.length());
+    }
+    printValue(out, encoding);
+  }
+
   void hasChanged(void)
   {
-    if (valuehasChanged())
+    if (changedValueOrNull() == nullptr)
+    {
+      return;
+    }
+
+    if (batched)
+    {
+      snapshotPending = true;
+    }
+
+    if (publishOwnTopic && topic.length() > 0)
+    {
+      char payload[THING_PAYLOAD_BUFFER_SIZE];
+      size_t len = formatPayload(payload, sizeof(payload));
+      if (len == 0)
+      {
+        return;
+      }
+      thing_mqtt_publish(topic.c_str(), payload, len, 1, true);
+    }
+  }
+
+  /**
+   * Publishes held back changes and heartbeats; call regularly.
+   */
+  void update(uint32_t now)
+  {
+    if (pollReporting(now))
     {
-      StaticJsonDocument<500> buf;
-      JsonObject prop_Payload = buf.to<JsonObject>();
-      this->serializeValue(prop_Payload);
-      String json_Payload;
-      serializeJson(prop_Payload, json_Payload);
-      Serial.println(json_Payload);
-      // TODO: figure out how to genericly publish property item
-      String prop_topic = "things/" + devID + "/properties/" + id;
-      // String prop_topic = "things/" + devID + "/properties/" + id;
-      // esp_mqtt_client_enqueue(mqtt_client, prop_topic.c_str(), json_Payload.c_str(), 0, 1, 1, true);
-      esp_mqtt_client_publish(mqtt_client, prop_topic.c_str(), json_Payload.c_str(), 0, 1, 1);
+      hasChanged();
     }
   }
 
@@ -709,7 +1146,6 @@ public:
   ThingDataType type;
   ThingDataValue value = {false};
   String timestamp;
-  ThingEventObject *next = nullptr;
 
   ThingEventObject(const char *name_, ThingDataType type_,
                    ThingDataValue value_)
@@ -720,6 +1156,17 @@ public:
                    ThingDataValue value_, String timestamp_)
       : name(name_), type(type_), value(value_), timestamp(timestamp_) {}
 
+  // allocated from a fixed pool, so `new` yields nullptr once it is empty
+  static void *operator new(size_t) noexcept { return pool().allocate(); }
+
+  static void operator delete(void *p) { pool().release(p); }
+
+  static ThingPool<ThingEventObject, THING_EVENT_POOL_SIZE> &pool()
+  {
+    static ThingPool<ThingEventObject, THING_EVENT_POOL_SIZE> p;
+    return p;
+  }
+
   ThingDataValue getValue() { return this->value; }
 
   void serialize(JsonObject obj)
@@ -755,9 +1202,36 @@ public:
   ThingDevice *next = nullptr;
   ThingProperty *firstProperty = nullptr;
   ThingAction *firstAction = nullptr;
-  ThingActionObject *actionQueue = nullptr;
   ThingEvent *firstEvent = nullptr;
-  ThingEventObject *eventQueue = nullptr;
+  // oldest first; the overflow policies can be changed at runtime
+  ThingQueue<ThingActionObject, THING_ACTION_QUEUE_CAPACITY> actionQueue{THING_OVERFLOW_DROP_OLDEST};
+  ThingQueue<ThingEventObject, THING_EVENT_QUEUE_CAPACITY> eventQueue{THING_OVERFLOW_DROP_OLDEST};
+  // MQTT thing id, set by the adapter: the MAC for its first device,
+  // "<MAC>-<id>" for the others
+  String thingId = "";
+  // "things/<thingId>", set by the MQTT adapter once the MAC is known
+  String topicBase = "";
+  String stateTopic = "";
+  // "t/<thingId>", the base of the property topics in compact mode
+  String compactTopicBase = "";
+  bool compact = false;
+  // 0 disables snapshots, see setBatching()
+  uint32_t batchWindowMs = 0;
+  bool keepPropertyTopics = true;
+  // snapshots go out at publishSlotMs + k * batchWindowMs, see setPublishSlot()
+  bool hasPublishSlot = false;
+  uint32_t publishSlotMs = 0;
+  // a disabled device publishes nothing, see setEnabled()
+  bool enabled = true;
+  ThingEncoding encoding = THING_ENCODING_JSON;
+  // bumped by every change that alters the Thing Description
+  uint32_t descriptionVersion = 1;
+  // version last published by the adapter, 0 forces a publish
+  uint32_t publishedDescriptionVersion = 0;
+  // TD parts currently retained on the broker, see ThingMQTTAdapter
+  size_t publishedDescriptionParts = 0;
+  // a TD (or its manifest) is retained on the broker
+  bool descriptionRetained = false;
 
   ThingDevice(const char *_id, const char *_title, const char **_type)
       : id(_id), title(_title), type(_type) {}
@@ -768,68 +1242,313 @@ public:
 
   ThingProperty *findProperty(const char *id)
   {
-    ThingProperty *p = this->firstProperty;
-    while (p)
-    {
-      if (!strcmp(p->id.c_str(), id))
-        return p;
-      p = (ThingProperty *)p->next;
-    }
-    return nullptr;
+    return propertyIndex.find(id);
   }
 
-  void addProperty(ThingProperty *property)
+  // id need not be NUL terminated, e.g. a segment of a topic or URI
+  ThingProperty *findProperty(const char *id, size_t len)
   {
-    property->next = firstProperty;
-    firstProperty = property;
+    return propertyIndex.find(id, len);
   }
 
-  ThingAction *findAction(const char *id)
+  /**
+   * Returns false, and leaves the device unchanged, if the id index could
+   * not grow to take the property.
+   */
+  bool addProperty(ThingProperty *property)
   {
-    ThingAction *a = this->firstAction;
-    while (a)
+    if (!propertyIndex.insert(property))
+    {
+      return false;
+    }
+    property->next = firstProperty;
+    firstProperty = property;
+    property->encoding = encoding;
+    property->alias = ++lastAlias;
+    property->compact = compact;
+    if (topicBase.length() > 0)
     {
-      if (!strcmp(a->id.c_str(), id))
-        return a;
-      a = (ThingAction *)a->next;
+      property->setTopicBase(topicBase, compactTopicBase);
     }
-    return nullptr;
+    applyBatching(property);
+    descriptionVersion++;
+    return true;
   }
 
-  ThingActionObject *findActionObject(const char *id)
+  /**
+   * Collects property changes for windowMs and publishes them as one
+   * {"time":..,"<id>":<value>,..} message on things/<MAC>/state.
+   * Per-property topics are only kept if keepPropertyTopics_ is set.
+   * A window of 0 switches back to per-property publishes.
+   */
+  void setBatching(uint32_t windowMs, bool keepPropertyTopics_ = false)
   {
-    ThingActionObject *a = this->actionQueue;
-    while (a)
+    batchWindowMs = windowMs;
+    keepPropertyTopics = keepPropertyTopics_;
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
     {
-      if (!strcmp(a->id.c_str(), id))
-        return a;
-      a = a->next;
+      applyBatching(property);
+      property = (ThingProperty *)property->next;
     }
-    return nullptr;
+    descriptionVersion++;
   }
 
-  void addAction(ThingAction *action)
+  /**
+   * Lets every property publish held back changes and heartbeats.
+   */
+  void update(uint32_t now)
   {
-    action->next = firstAction;
-    firstAction = action;
+    bool anyPending = false;
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
+    {
+      property->update(now);
+      anyPending |= property->snapshotPending;
+      property = (ThingProperty *)property->next;
+    }
+
+    if (!anyPending)
+    {
+      return;
+    }
+
+    if (!snapshotOpen)
+    {
+      snapshotOpen = true;
+      snapshotOpenedMs = now;
+      snapshotDelayMs = hasPublishSlot ? untilPublishSlot(now) : batchWindowMs;
+    }
+
+    if (now - snapshotOpenedMs >= snapshotDelayMs)
+    {
+      publishSnapshot();
+    }
   }
 
-  ThingEvent *findEvent(const char *id)
+  /**
+   * Publishes snapshots at fixed points of the batch window, offsetMs
+   * (millis() modulo batchWindowMs) into it, instead of one window after
+   * the first change. A gateway gives its devices different offsets so
+   * their publishes are spread over the window rather than bunched up.
+   */
+  void setPublishSlot(uint32_t offsetMs)
+  {
+    hasPublishSlot = true;
+    publishSlotMs = offsetMs;
+    snapshotOpen = false;
+  }
+
+  /**
+   * Stops (or resumes) all value publishes of this device, heartbeats
+   * included; pending changes are dropped. The TD is not touched, so
+   * enabling the device again does not rebuild it.
+   */
+  void setEnabled(bool enabled_)
+  {
+    enabled = enabled_;
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
+    {
+      applyBatching(property);
+      property = (ThingProperty *)property->next;
+    }
+    snapshotOpen = false;
+  }
+
+  /**
+   * Publishes all pending property values on the state topic, splitting
+   * into several messages if they exceed THING_SNAPSHOT_BUFFER_SIZE.
+   */
+  void publishSnapshot()
+  {
+    snapshotOpen = false;
+    if (stateTopic.length() == 0)
+    {
+      return;
+    }
+
+    char payload[THING_SNAPSHOT_BUFFER_SIZE];
+    ThingBufferPrint out(payload, sizeof(payload) - 1);
+    uint16_t entries = 0;
+
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
+    {
+      if (!property->snapshotPending)
+      {
+        property = (ThingProperty *)property->next;
+        continue;
+      }
+
+      if (entries == 0)
+      {
+        openSnapshot(out, latestPendingTimestamp());
+      }
+
+      size_t mark = out.length();
+      property->printValueMember(out);
+
+      if (out.overflow())
+      {
+        out.rewind(mark);
+        if (entries == 0)
+        {
+          // a single value that does not fit at all
+          property->snapshotPending = false;
+          property = (ThingProperty *)property->next;
+          out.rewind(0);
+          continue;
+        }
+        publishSnapshotPayload(payload, out.length(), entries);
+        out.rewind(0);
+        entries = 0;
+        continue;
+      }
+
+      entries++;
+      property->snapshotPending = false;
+      property = (ThingProperty *)property->next;
+    }
+
+    if (entries > 0)
+    {
+      publishSnapshotPayload(payload, out.length(), entries);
+    }
+  }
+
+  /**
+   * Switches value, snapshot and TD publishes to the given encoding.
+   * MessagePack topics carry a "/msgpack" suffix.
+   */
+  void setEncoding(ThingEncoding encoding_)
+  {
+    encoding = encoding_;
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
+    {
+      property->encoding = encoding;
+      property = (ThingProperty *)property->next;
+    }
+    if (topicBase.length() > 0)
+    {
+      setTopicBase(topicBase);
+    }
+    descriptionVersion++;
+  }
+
+  /**
+   * Publishes values on t/<thingId>/<alias> as [<epoch ms>,<value>], and
+   * keys snapshot members by alias. Aliases follow the order of
+   * addProperty() calls; the TD maps them back to property names.
+   */
+  void setCompact(bool compact_)
+  {
+    compact = compact_;
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
+    {
+      property->compact = compact;
+      property = (ThingProperty *)property->next;
+    }
+    if (topicBase.length() > 0)
+    {
+      setTopicBase(topicBase);
+    }
+    descriptionVersion++;
+  }
+
+  void setTopicBase(const String &base)
+  {
+    topicBase = base;
+    stateTopic = base + "/state" + thing_encoding_topic_suffix(encoding);
+    compactTopicBase = "t/" + thingId;
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
+    {
+      property->setTopicBase(topicBase, compactTopicBase);
+      property = (ThingProperty *)property->next;
+    }
+    descriptionVersion++;
+  }
+
+  /**
+   * The Thing Description for thingId in the device encoding, kept in
+   * THING_CHUNK_SIZE blocks and only regenerated when descriptionVersion
+   * has changed. ip (the broker address) is assumed not to change.
+   */
+  const ThingChunkBuffer &cachedDescription(String ip)
+  {
+    if (cachedDescriptionVersion != descriptionVersion)
+    {
+      descriptionCache.clear();
+      serialize(descriptionCache, ip, thingId, encoding);
+      cachedDescriptionVersion = descriptionVersion;
+    }
+    return descriptionCache;
+  }
+
+  /**
+   * FNV-1a hash of the JSON Thing Description serialize(Print &, ip, MAC)
+   * writes, e.g. for HTTP ETags; only recomputed when descriptionVersion
+   * has changed. ip and MAC are assumed not to change.
+   */
+  uint32_t descriptionHash(String ip, String MAC)
   {
-    ThingEvent *e = this->firstEvent;
-    while (e)
+    if (hashedDescriptionVersion != descriptionVersion)
     {
-      if (!strcmp(e->id.c_str(), id))
-        return e;
-      e = (ThingEvent *)e->next;
+      ThingHashPrint hash;
+      serialize(hash, ip, MAC);
+      descriptionHashValue = hash.value();
+      hashedDescriptionVersion = descriptionVersion;
     }
-    return nullptr;
+    return descriptionHashValue;
+  }
+
+  ThingAction *findAction(const char *id)
+  {
+    return actionIndex.find(id);
+  }
+
+  ThingAction *findAction(const char *id, size_t len)
+  {
+    return actionIndex.find(id, len);
+  }
+
+  ThingActionObject *findActionObject(const char *id)
+  {
+    return actionObjectIndex.find(id);
+  }
+
+  // false if the id index could not grow; the device is left unchanged
+  bool addAction(ThingAction *action)
+  {
+    if (!actionIndex.insert(action))
+    {
+      return false;
+    }
+    action->next = firstAction;
+    firstAction = action;
+    descriptionVersion++;
+    return true;
+  }
+
+  ThingEvent *findEvent(const char *id)
+  {
+    return eventIndex.find(id);
   }
 
-  void addEvent(ThingEvent *event)
+  // false if the id index could not grow; the device is left unchanged
+  bool addEvent(ThingEvent *event)
   {
+    if (!eventIndex.insert(event))
+    {
+      return false;
+    }
     event->next = firstEvent;
     firstEvent = event;
+    descriptionVersion++;
+    return true;
   }
 
   void setProperty(const char *name, const JsonVariant &newValue)
@@ -895,6 +1614,11 @@ public:
       return nullptr;
     }
 
+    if (!makeRoomForAction())
+    {
+      return nullptr;
+    }
+
     ThingActionObject *obj = action->create(actionRequest);
     if (obj == nullptr)
     {
@@ -930,45 +1654,228 @@ public:
 
   void removeAction(String id)
   {
-    ThingActionObject *curr = actionQueue;
-    ThingActionObject *prev = nullptr;
-    while (curr != nullptr)
+    ThingActionObject *obj = findActionObject(id.c_str());
+    if (obj == nullptr)
+    {
+      return;
+    }
+
+    actionQueue.remove(obj);
+    obj->cancel();
+    discardActionObject(obj);
+  }
+
+  /**
+   * Takes ownership of obj. Returns false, and frees obj, if the queue is
+   * full and nothing may be dropped, or if obj could not be indexed.
+   */
+  bool queueActionObject(ThingActionObject *obj)
+  {
+    if (!makeRoomForAction() || !actionObjectIndex.insert(obj))
+    {
+      discardActionObject(obj);
+      return false;
+    }
+
+    actionQueue.push(obj);
+    return true;
+  }
+
+  /**
+   * Takes ownership of obj, which must come from `new ThingEventObject`.
+   * Returns false if it was rejected (and freed).
+   */
+  bool queueEventObject(ThingEventObject *obj)
+  {
+    // `new` found the pool empty
+    if (obj == nullptr)
+    {
+      eventQueue.reject();
+      return false;
+    }
+    ThingEventObject *displaced = eventQueue.push(obj);
+    if (displaced != nullptr)
+    {
+      delete displaced;
+    }
+    return displaced != obj;
+  }
+
+  /**
+   * Records an event occurrence. Under THING_OVERFLOW_DROP_OLDEST the
+   * oldest entry is freed first, so a full queue never exhausts the pool.
+   */
+  ThingEventObject *queueEvent(const char *name, ThingDataType type, ThingDataValue value,
+                               String timestamp = "1970-01-01T00:00:00+00:00")
+  {
+    if (eventQueue.full())
     {
-      if (curr->id == id)
+      if (eventQueue.policy == THING_OVERFLOW_REJECT)
       {
-        if (prev == nullptr)
-        {
-          actionQueue = curr->next;
-        }
-        else
-        {
-          prev->next = curr->next;
-        }
+        eventQueue.reject();
+        return nullptr;
+      }
+      ThingEventObject *oldest = eventQueue.oldest();
+      eventQueue.evict(oldest);
+      delete oldest;
+    }
 
-        curr->cancel();
-        delete curr->actionRequest;
-        delete curr;
-        return;
+    ThingEventObject *obj = new ThingEventObject(name, type, value, timestamp);
+    if (obj == nullptr)
+    {
+      eventQueue.reject();
+      return nullptr;
+    }
+    eventQueue.push(obj);
+    return obj;
+  }
+
+  ThingQueueStats getActionQueueStats() { return actionQueue.getStats(); }
+
+  ThingQueueStats getEventQueueStats() { return eventQueue.getStats(); }
+
+  void serialize(JsonObject descr, String ip, String MAC)
+  {
+    serializeHeader(descr, ip, MAC);
+
+    ThingProperty *property = this->firstProperty;
+    if (property != nullptr)
+    {
+      JsonObject properties = descr.createNestedObject("properties");
+      while (property != nullptr)
+      {
+        JsonObject obj = properties.createNestedObject(property->id);
+        property->serialize(obj, ip, MAC);
+        property = (ThingProperty *)property->next;
       }
+    }
 
-      prev = curr;
-      curr = curr->next;
+    ThingAction *action = this->firstAction;
+    if (action != nullptr)
+    {
+      JsonObject actions = descr.createNestedObject("actions");
+      while (action != nullptr)
+      {
+        JsonObject obj = actions.createNestedObject(action->id);
+        action->serialize(obj, id);
+        action = action->next;
+      }
+    }
+
+    ThingEvent *event = this->firstEvent;
+    if (event != nullptr)
+    {
+      JsonObject events = descr.createNestedObject("events");
+      while (event != nullptr)
+      {
+        JsonObject obj = events.createNestedObject(event->id);
+        event->serialize_event(obj, id);
+        event = (ThingEvent *)event->next;
+      }
     }
   }
 
-  void queueActionObject(ThingActionObject *obj)
+  /**
+   * Streams the same Thing Description as serialize(JsonObject, ...) to out.
+   * Only one item is materialized at a time, in a document of
+   * TD_ITEM_JSON_DOCUMENT_SIZE bytes.
+   */
+  void serialize(Print &out, String ip, String MAC,
+                 ThingEncoding encoding_ = THING_ENCODING_JSON)
   {
-    obj->next = actionQueue;
-    actionQueue = obj;
+    size_t memberCount = encoding_ == THING_ENCODING_MSGPACK ? descriptionMemberCount(ip, MAC) : 0;
+    ThingObjectWriter descr(out, encoding_, memberCount);
+    serializeMembers(descr, ip, MAC);
+    descr.end();
   }
 
-  void queueEventObject(ThingEventObject *obj)
+  /**
+   * Exact length in bytes of what serialize(Print &, ...) writes.
+   */
+  size_t measureDescription(String ip, String MAC,
+                            ThingEncoding encoding_ = THING_ENCODING_JSON)
   {
-    obj->next = eventQueue;
-    eventQueue = obj;
+    ThingCountingPrint counter;
+    serialize(counter, ip, MAC, encoding_);
+    return counter.count();
   }
 
-  void serialize(JsonObject descr, String ip, String MAC)
+  /**
+   * Number of top level members serializeMembers() writes, needed up front
+   * for MessagePack maps.
+   */
+  size_t descriptionMemberCount(String ip, String MAC)
+  {
+    DynamicJsonDocument item(TD_ITEM_JSON_DOCUMENT_SIZE);
+    serializeHeader(item.to<JsonObject>(), ip, MAC);
+    return item.size() + (firstProperty != nullptr) + (firstAction != nullptr) +
+           (firstEvent != nullptr);
+  }
+
+  void serializeMembers(ThingObjectWriter &descr, String ip, String MAC)
+  {
+    DynamicJsonDocument item(TD_ITEM_JSON_DOCUMENT_SIZE);
+    ThingEncoding enc = descr.getEncoding();
+
+    serializeHeader(item.to<JsonObject>(), ip, MAC);
+    descr.members(item.as<JsonObjectConst>());
+
+    ThingProperty *property = this->firstProperty;
+    if (property != nullptr)
+    {
+      descr.key("properties");
+      ThingObjectWriter properties(descr.stream(), enc, countItems(property));
+      while (property != nullptr)
+      {
+        item.clear();
+        JsonObject obj = item.to<JsonObject>();
+        property->serialize(obj, ip, MAC);
+        properties.member(property->id.c_str(), obj);
+        property = (ThingProperty *)property->next;
+      }
+      properties.end();
+    }
+
+    ThingAction *action = this->firstAction;
+    if (action != nullptr)
+    {
+      size_t count = 0;
+      for (ThingAction *a = action; a != nullptr; a = a->next)
+      {
+        count++;
+      }
+
+      descr.key("actions");
+      ThingObjectWriter actions(descr.stream(), enc, count);
+      while (action != nullptr)
+      {
+        item.clear();
+        JsonObject obj = item.to<JsonObject>();
+        action->serialize(obj, id);
+        actions.member(action->id.c_str(), obj);
+        action = action->next;
+      }
+      actions.end();
+    }
+
+    ThingEvent *event = this->firstEvent;
+    if (event != nullptr)
+    {
+      descr.key("events");
+      ThingObjectWriter events(descr.stream(), enc, countItems(event));
+      while (event != nullptr)
+      {
+        item.clear();
+        JsonObject obj = item.to<JsonObject>();
+        event->serialize_event(obj, id);
+        events.member(event->id.c_str(), obj);
+        event = (ThingEvent *)event->next;
+      }
+      events.end();
+    }
+  }
+
+  void serializeHeader(JsonObject descr, String ip, String MAC)
   {
     // descr["id"] = ip + ":1883/things/" + this->id;
     descr["id"] = ip + ":1883/things/" + MAC;
@@ -1022,91 +1929,259 @@ public:
       type++;
     }
 
-    ThingProperty *property = this->firstProperty;
-    if (property != nullptr)
-    {
-      Serial.println("Try to serialize properties.");
-      JsonObject properties = descr.createNestedObject("properties");
-      while (property != nullptr)
-      {
-        JsonObject obj = properties.createNestedObject(property->id);
-        property->serialize(obj, ip, MAC);
-        property = (ThingProperty *)property->next;
-      }
-    }
-
-    ThingAction *action = this->firstAction;
-    if (action != nullptr)
+    if (batchWindowMs > 0)
     {
-      JsonObject actions = descr.createNestedObject("actions");
-      while (action != nullptr)
+      JsonArray forms = descr.createNestedArray("forms");
+      JsonObject state = forms.createNestedObject();
+      JsonArray op = state.createNestedArray("op");
+      op.add("observeallproperties");
+      state["href"] = ip + ":1883/things/" + MAC + "/state" + thing_encoding_topic_suffix(encoding);
+      state["contentType"] = thing_encoding_content_type(encoding);
+      if (compact)
       {
-        JsonObject obj = actions.createNestedObject(action->id);
-        action->serialize(obj, id);
-        action = action->next;
-      }
-    }
-
-    ThingEvent *event = this->firstEvent;
-    if (event != nullptr)
-    {
-      JsonObject events = descr.createNestedObject("events");
-      while (event != nullptr)
-      {
-        JsonObject obj = events.createNestedObject(event->id);
-        event->serialize_event(obj, id);
-        event = (ThingEvent *)event->next;
+        // members are keyed by the "mqv:alias" of each property form
+        state["mqv:keys"] = "mqv:alias";
       }
     }
   }
 
+  // newest first
   void serializeActionQueue(JsonArray array)
   {
-    ThingActionObject *curr = actionQueue;
-    while (curr != nullptr)
+    for (size_t i = actionQueue.size(); i-- > 0;)
     {
       JsonObject action = array.createNestedObject();
-      curr->serialize(action, id);
-      curr = curr->next;
+      actionQueue.at(i)->serialize(action, id);
     }
   }
 
   void serializeActionQueue(JsonArray array, String name)
   {
-    ThingActionObject *curr = actionQueue;
-    while (curr != nullptr)
+    for (size_t i = actionQueue.size(); i-- > 0;)
     {
+      ThingActionObject *curr = actionQueue.at(i);
       if (curr->name == name)
       {
         JsonObject action = array.createNestedObject();
         curr->serialize(action, id);
       }
-      curr = curr->next;
     }
   }
 
+  // newest first
   void serializeEventQueue(JsonArray array)
   {
-    ThingEventObject *curr = eventQueue;
-    while (curr != nullptr)
+    for (size_t i = eventQueue.size(); i-- > 0;)
     {
       JsonObject event = array.createNestedObject();
-      curr->serialize(event);
-      curr = curr->next;
+      eventQueue.at(i)->serialize(event);
     }
   }
 
   void serializeEventQueue(JsonArray array, String name)
   {
-    ThingEventObject *curr = eventQueue;
-    while (curr != nullptr)
+    for (size_t i = eventQueue.size(); i-- > 0;)
     {
+      ThingEventObject *curr = eventQueue.at(i);
       if (curr->name == name)
       {
         JsonObject event = array.createNestedObject();
         curr->serialize(event);
       }
-      curr = curr->next;
     }
   }
+
+  /**
+   * Streams the same array as serializeActionQueue(array) to out, one
+   * action in a SMALL_JSON_DOCUMENT_SIZE document at a time.
+   */
+  void printActionQueue(Print &out, ThingEncoding encoding_)
+  {
+    DynamicJsonDocument item(SMALL_JSON_DOCUMENT_SIZE);
+    size_t count = actionQueue.size();
+    printArrayStart(out, count, encoding_);
+    for (size_t i = count; i-- > 0;)
+    {
+      item.clear();
+      JsonObject action = item.to<JsonObject>();
+      actionQueue.at(i)->serialize(action, id);
+      printArrayItem(out, item, i == count - 1, encoding_);
+    }
+    printArrayEnd(out, encoding_);
+  }
+
+  // as printActionQueue(), for serializeEventQueue(array)
+  void printEventQueue(Print &out, ThingEncoding encoding_)
+  {
+    DynamicJsonDocument item(SMALL_JSON_DOCUMENT_SIZE);
+    size_t count = eventQueue.size();
+    printArrayStart(out, count, encoding_);
+    for (size_t i = count; i-- > 0;)
+    {
+      item.clear();
+      JsonObject event = item.to<JsonObject>();
+      eventQueue.at(i)->serialize(event);
+      printArrayItem(out, item, i == count - 1, encoding_);
+    }
+    printArrayEnd(out, encoding_);
+  }
+
+private:
+  bool snapshotOpen = false;
+  uint32_t snapshotOpenedMs = 0;
+  uint32_t snapshotDelayMs = 0;
+  uint16_t lastAlias = 0;
+
+  // time from now to the next publish slot, 0 if now is one
+  uint32_t untilPublishSlot(uint32_t now)
+  {
+    if (batchWindowMs == 0)
+    {
+      return 0;
+    }
+    return (batchWindowMs - (now - publishSlotMs) % batchWindowMs) % batchWindowMs;
+  }
+
+  void applyBatching(ThingProperty *property)
+  {
+    property->batched = enabled && batchWindowMs > 0;
+    property->publishOwnTopic = enabled && (batchWindowMs == 0 || keepPropertyTopics);
+    if (!property->batched)
+    {
+      property->snapshotPending = false;
+    }
+  }
+
+  static void printArrayStart(Print &out, size_t count, ThingEncoding encoding_)
+  {
+    if (encoding_ == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_array(out, count);
+      return;
+    }
+    out.write('[');
+  }
+
+  static void printArrayItem(Print &out, JsonVariantConst value, bool first,
+                             ThingEncoding encoding_)
+  {
+    if (!first && encoding_ == THING_ENCODING_JSON)
+    {
+      out.write(',');
+    }
+    thing_serialize(value, out, encoding_);
+  }
+
+  static void printArrayEnd(Print &out, ThingEncoding encoding_)
+  {
+    if (encoding_ == THING_ENCODING_JSON)
+    {
+      out.write(']');
+    }
+  }
+
+  static size_t countItems(ThingItem *item)
+  {
+    size_t count = 0;
+    for (; item != nullptr; item = item->next)
+    {
+      count++;
+    }
+    return count;
+  }
+
+  // MessagePack maps start with a map16 header whose count is patched in
+  // publishSnapshotPayload(), the time entry is counted there too.
+  void openSnapshot(Print &out, int64_t timestampMs)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      const uint8_t map16[3] = {0xde, 0, 0};
+      out.write(map16, sizeof(map16));
+    }
+    else
+    {
+      out.write('{');
+    }
+    ThingProperty::printTimeMember(out, encoding, timestampMs);
+  }
+
+  // a snapshot carries one time, that of its most recent sample
+  int64_t latestPendingTimestamp()
+  {
+    int64_t latest = 0;
+    ThingProperty *property = this->firstProperty;
+    while (property != nullptr)
+    {
+      if (property->snapshotPending && property->getTimestamp() > latest)
+      {
+        latest = property->getTimestamp();
+      }
+      property = (ThingProperty *)property->next;
+    }
+    return latest;
+  }
+
+  // payload has one byte spare for the closing brace (see publishSnapshot)
+  void publishSnapshotPayload(char *payload, size_t len, uint16_t entries)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      payload[1] = (char)((entries + 1) >> 8);
+      payload[2] = (char)((entries + 1) & 0xff);
+    }
+    else
+    {
+      payload[len++] = '}';
+    }
+    thing_mqtt_publish(stateTopic.c_str(), payload, len, 1, true);
+  }
+
+  /**
+   * Ensures the action queue can take one more entry. A full queue under
+   * THING_OVERFLOW_DROP_OLDEST drops its oldest finished action; running
+   * ones are never dropped, so the request is rejected if none has finished.
+   */
+  bool makeRoomForAction()
+  {
+    if (!actionQueue.full())
+    {
+      return true;
+    }
+
+    if (actionQueue.policy == THING_OVERFLOW_DROP_OLDEST)
+    {
+      for (size_t i = 0; i < actionQueue.size(); i++)
+      {
+        ThingActionObject *obj = actionQueue.at(i);
+        if (obj->isFinished())
+        {
+          actionQueue.evict(obj);
+          discardActionObject(obj);
+          return true;
+        }
+      }
+    }
+
+    actionQueue.reject();
+    return false;
+  }
+
+  void discardActionObject(ThingActionObject *obj)
+  {
+    actionObjectIndex.remove(obj);
+    obj->release();
+  }
+
+  ThingChunkBuffer descriptionCache;
+  uint32_t cachedDescriptionVersion = 0;
+  uint32_t hashedDescriptionVersion = 0;
+  uint32_t descriptionHashValue = 0;
+
+  // Lookup indices kept alongside the linked lists, which stay the
+  // iteration order used for serialization.
+  ThingIndex<ThingProperty> propertyIndex;
+  ThingIndex<ThingAction> actionIndex;
+  ThingIndex<ThingEvent> eventIndex;
+  ThingIndex<ThingActionObject> actionObjectIndex;
 };
@@ -0,0 +1,199 @@
+/**
+ * ThingActionExecutor.h
+ *
+ * Runs requested actions off the thread that accepted them: a bounded work
+ * queue drained by a FreeRTOS task on ESP32, a std::thread on a host build,
+ * and by poll() from the main loop on single threaded Arduino targets.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "Thing.h"
+
+#if defined(THING_PLATFORM_FREERTOS)
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#elif defined(THING_PLATFORM_HOST)
+#include <condition_variable>
+#include <thread>
+#endif
+
+#ifndef THING_ACTION_EXECUTOR_QUEUE_LENGTH
+#define THING_ACTION_EXECUTOR_QUEUE_LENGTH 8
+#endif
+
+#ifndef THING_ACTION_EXECUTOR_STACK_SIZE
+#define THING_ACTION_EXECUTOR_STACK_SIZE 4096
+#endif
+
+#ifndef THING_ACTION_EXECUTOR_PRIORITY
+#define THING_ACTION_EXECUTOR_PRIORITY 1
+#endif
+
+class ThingActionExecutor
+{
+public:
+  ThingActionExecutor() = default;
+  ThingActionExecutor(const ThingActionExecutor &) = delete;
+  ThingActionExecutor &operator=(const ThingActionExecutor &) = delete;
+
+  ~ThingActionExecutor()
+  {
+#if defined(THING_PLATFORM_HOST)
+    if (worker.joinable())
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      ready.notify_one();
+      worker.join();
+    }
+#endif
+  }
+
+  // Starts the worker; call once before the first submit().
+  bool begin()
+  {
+#if defined(THING_PLATFORM_FREERTOS)
+    if (queue != nullptr)
+    {
+      return true;
+    }
+    queue = xQueueCreate(THING_ACTION_EXECUTOR_QUEUE_LENGTH, sizeof(ThingActionObject *));
+    if (queue == nullptr)
+    {
+      return false;
+    }
+    return xTaskCreate(run, "thing_actions", THING_ACTION_EXECUTOR_STACK_SIZE, this,
+                       THING_ACTION_EXECUTOR_PRIORITY, nullptr) == pdPASS;
+#elif defined(THING_PLATFORM_HOST)
+    if (!worker.joinable())
+    {
+      worker = std::thread([this]() { run(this); });
+    }
+    return true;
+#else
+    return true;
+#endif
+  }
+
+  /**
+   * Queues obj for execution and marks it pending. Returns false, leaving
+   * obj as it was, if the work queue is full.
+   */
+  bool submit(ThingActionObject *obj)
+  {
+    obj->retain();
+    obj->setStatus("pending");
+
+#if defined(THING_PLATFORM_FREERTOS)
+    if (queue != nullptr && xQueueSend(queue, &obj, 0) == pdTRUE)
+    {
+      return true;
+    }
+#else
+    {
+#if defined(THING_PLATFORM_HOST)
+      std::lock_guard<std::mutex> lock(mutex);
+#endif
+      if (count < THING_ACTION_EXECUTOR_QUEUE_LENGTH)
+      {
+        items[(head + count) % THING_ACTION_EXECUTOR_QUEUE_LENGTH] = obj;
+        count++;
+#if defined(THING_PLATFORM_HOST)
+        ready.notify_one();
+#endif
+        return true;
+      }
+    }
+#endif
+
+    rejected++;
+    obj->setStatus("created");
+    obj->release();
+    return false;
+  }
+
+  /**
+   * Runs the queued actions on single threaded targets; call from the main
+   * loop. Does nothing where a worker task exists.
+   */
+  void poll()
+  {
+#if !defined(THING_PLATFORM_FREERTOS) && !defined(THING_PLATFORM_HOST)
+    while (count > 0)
+    {
+      ThingActionObject *obj = items[head];
+      head = (head + 1) % THING_ACTION_EXECUTOR_QUEUE_LENGTH;
+      count--;
+      executeOne(obj);
+    }
+#endif
+  }
+
+  // number of submit() calls refused because the work queue was full
+  uint32_t rejectedCount() const { return rejected; }
+
+private:
+  uint32_t rejected = 0;
+
+#if defined(THING_PLATFORM_FREERTOS)
+  QueueHandle_t queue = nullptr;
+#else
+  ThingActionObject *items[THING_ACTION_EXECUTOR_QUEUE_LENGTH];
+  size_t head = 0;
+  size_t count = 0;
+#endif
+
+#if defined(THING_PLATFORM_HOST)
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::thread worker;
+  bool stopping = false;
+#endif
+
+  static void executeOne(ThingActionObject *obj)
+  {
+    obj->execute();
+    obj->release();
+  }
+
+  static void run(void *arg)
+  {
+    ThingActionExecutor *self = (ThingActionExecutor *)arg;
+#if defined(THING_PLATFORM_FREERTOS)
+    for (;;)
+    {
+      ThingActionObject *obj;
+      if (xQueueReceive(self->queue, &obj, portMAX_DELAY) == pdTRUE)
+      {
+        executeOne(obj);
+      }
+    }
+#elif defined(THING_PLATFORM_HOST)
+    for (;;)
+    {
+      ThingActionObject *obj;
+      {
+        std::unique_lock<std::mutex> lock(self->mutex);
+        self->ready.wait(lock, [self]() { return self->stopping || self->count > 0; });
+        if (self->count == 0)
+        {
+          return;
+        }
+        obj = self->items[self->head];
+        self->head = (self->head + 1) % THING_ACTION_EXECUTOR_QUEUE_LENGTH;
+        self->count--;
+      }
+      executeOne(obj);
+    }
+#else
+    (void)self;
+#endif
+  }
+};
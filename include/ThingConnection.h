@@ -0,0 +1,192 @@
+/**
+ * ThingConnection.h
+ *
+ * Reconnect schedule for the MQTT client. After the connection is lost the
+ * next attempt waits a random time of up to the current backoff ("full
+ * jitter"), and the backoff doubles with every failed attempt up to a
+ * ceiling, so a fleet dropped by a broker restart does not come back in the
+ * same second. Timestamps are millis() values passed in by the caller.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "ThingPlatform.h"
+
+#ifndef THING_RECONNECT_MIN_MS
+#define THING_RECONNECT_MIN_MS 2000
+#endif
+
+#ifndef THING_RECONNECT_MAX_MS
+#define THING_RECONNECT_MAX_MS 120000
+#endif
+
+// an attempt without CONNECTED or DISCONNECTED event counts as failed
+#ifndef THING_CONNECT_TIMEOUT_MS
+#define THING_CONNECT_TIMEOUT_MS 30000
+#endif
+
+#ifndef THING_MQTT_KEEPALIVE_S
+#define THING_MQTT_KEEPALIVE_S 60
+#endif
+
+enum ThingConnectionState
+{
+  THING_CONNECTION_WAITING,
+  THING_CONNECTION_CONNECTING,
+  THING_CONNECTION_CONNECTED
+};
+
+struct ThingConnectionStats
+{
+  // successful connections, the first one included
+  uint32_t connects = 0;
+  // connections made after one was lost
+  uint32_t reconnects = 0;
+  uint32_t attempts = 0;
+  uint32_t failures = 0;
+  // from losing the connection to being connected again, in milliseconds
+  uint32_t lastReconnectMs = 0;
+  uint32_t maxReconnectMs = 0;
+  // upper bound of the next delay
+  uint32_t backoffMs = 0;
+};
+
+class ThingConnectionManager
+{
+public:
+  void setBackoff(uint32_t minMs, uint32_t maxMs)
+  {
+    ThingLock lock(mutex);
+    minBackoffMs = minMs > 0 ? minMs : 1;
+    maxBackoffMs = maxMs > minBackoffMs ? maxMs : minBackoffMs;
+    backoffMs = minBackoffMs;
+  }
+
+  // the client makes the first attempt by itself when it is started
+  void started(uint32_t now)
+  {
+    ThingLock lock(mutex);
+    state = THING_CONNECTION_CONNECTING;
+    attemptStartedMs = now;
+  }
+
+  // MQTT_EVENT_CONNECTED
+  void connected(uint32_t now)
+  {
+    ThingLock lock(mutex);
+    if (state == THING_CONNECTION_CONNECTED)
+    {
+      return;
+    }
+
+    stats.connects++;
+    if (wasConnected)
+    {
+      uint32_t downMs = now - lostMs;
+      stats.reconnects++;
+      stats.lastReconnectMs = downMs;
+      if (downMs > stats.maxReconnectMs)
+      {
+        stats.maxReconnectMs = downMs;
+      }
+    }
+    wasConnected = true;
+    state = THING_CONNECTION_CONNECTED;
+    backoffMs = minBackoffMs;
+  }
+
+  /**
+   * MQTT_EVENT_DISCONNECTED, which the client also reports for a failed
+   * attempt. Schedules the next attempt.
+   */
+  void disconnected(uint32_t now)
+  {
+    ThingLock lock(mutex);
+    if (state == THING_CONNECTION_WAITING)
+    {
+      return;
+    }
+    if (state == THING_CONNECTION_CONNECTED)
+    {
+      lostMs = now;
+    }
+    else
+    {
+      stats.failures++;
+    }
+    schedule(now);
+  }
+
+  /**
+   * True once when the next attempt is due; the caller then starts it.
+   * Call regularly from the main loop.
+   */
+  bool due(uint32_t now)
+  {
+    ThingLock lock(mutex);
+    if (state == THING_CONNECTION_CONNECTING &&
+        elapsed(attemptStartedMs, now) >= (int32_t)THING_CONNECT_TIMEOUT_MS)
+    {
+      stats.failures++;
+      schedule(now);
+    }
+    if (state != THING_CONNECTION_WAITING || elapsed(waitStartedMs, now) < (int32_t)delayMs)
+    {
+      return false;
+    }
+
+    state = THING_CONNECTION_CONNECTING;
+    attemptStartedMs = now;
+    stats.attempts++;
+    return true;
+  }
+
+  ThingConnectionState getState()
+  {
+    ThingLock lock(mutex);
+    return state;
+  }
+
+  ThingConnectionStats getStats()
+  {
+    ThingLock lock(mutex);
+    ThingConnectionStats s = stats;
+    s.backoffMs = backoffMs;
+    return s;
+  }
+
+private:
+  ThingConnectionState state = THING_CONNECTION_WAITING;
+  bool wasConnected = false;
+  uint32_t minBackoffMs = THING_RECONNECT_MIN_MS;
+  uint32_t maxBackoffMs = THING_RECONNECT_MAX_MS;
+  uint32_t backoffMs = THING_RECONNECT_MIN_MS;
+  uint32_t delayMs = 0;
+  uint32_t waitStartedMs = 0;
+  uint32_t attemptStartedMs = 0;
+  uint32_t lostMs = 0;
+  ThingConnectionStats stats;
+  ThingMutex mutex;
+
+  // signed, as events from the MQTT task may carry a later time than the
+  // caller sampled before taking the lock
+  static int32_t elapsed(uint32_t since, uint32_t now)
+  {
+    return (int32_t)(now - since);
+  }
+
+  // caller holds the mutex
+  void schedule(uint32_t now)
+  {
+    state = THING_CONNECTION_WAITING;
+    waitStartedMs = now;
+    delayMs = 1 + thing_random() % backoffMs;
+    backoffMs = backoffMs > maxBackoffMs / 2 ? maxBackoffMs : backoffMs * 2;
+  }
+};
@@ -0,0 +1,278 @@
+/**
+ * ThingHistory.h
+ *
+ * Optional fixed-size value history of a property: the last raw samples
+ * plus 1-minute and 15-minute min/max/avg rollups, updated incrementally
+ * on every setValue so history survives broker outages.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "ThingStream.h"
+
+#ifndef THING_HISTORY_RAW_CAPACITY
+#define THING_HISTORY_RAW_CAPACITY 64
+#endif
+
+// one hour of 1-minute buckets
+#ifndef THING_HISTORY_MINUTE_CAPACITY
+#define THING_HISTORY_MINUTE_CAPACITY 60
+#endif
+
+// one day of 15-minute buckets
+#ifndef THING_HISTORY_QUARTER_CAPACITY
+#define THING_HISTORY_QUARTER_CAPACITY 96
+#endif
+
+enum ThingHistoryResolution
+{
+  HISTORY_RAW,
+  HISTORY_1MIN,
+  HISTORY_15MIN
+};
+
+struct ThingHistorySample
+{
+  int64_t timeMs;
+  double value;
+};
+
+struct ThingHistoryBucket
+{
+  int64_t startMs;
+  double min;
+  double max;
+  double sum;
+  uint32_t count;
+};
+
+/**
+ * Circular buffer that overwrites its oldest entry when full.
+ */
+template <class T, size_t N>
+class ThingRing
+{
+public:
+  void push(const T &item)
+  {
+    items[head] = item;
+    head = (head + 1) % N;
+    if (count < N)
+    {
+      count++;
+    }
+  }
+
+  // 0 is the oldest entry
+  T &at(size_t i) { return items[(head + N - count + i) % N]; }
+
+  T &back() { return items[(head + N - 1) % N]; }
+
+  size_t size() const { return count; }
+
+private:
+  T items[N];
+  size_t head = 0;
+  size_t count = 0;
+};
+
+class ThingHistory
+{
+public:
+  void record(int64_t timeMs, double value)
+  {
+    ThingHistorySample sample = {timeMs, value};
+    raw.push(sample);
+    accumulate(minutes, MINUTE_MS, timeMs, value);
+    accumulate(quarters, QUARTER_MS, timeMs, value);
+  }
+
+  /**
+   * Writes the entries newer than sinceMs, oldest first, as positional
+   * arrays: raw samples as [time, value], buckets as
+   * [start, min, max, avg, count]. A bucket counts as newer if it ends
+   * after sinceMs, so the one containing sinceMs is included. Times are
+   * epoch milliseconds.
+   */
+  void print(Print &out, ThingHistoryResolution resolution, int64_t sinceMs,
+             ThingEncoding encoding = THING_ENCODING_JSON)
+  {
+    switch (resolution)
+    {
+    case HISTORY_RAW:
+      printSamples(out, raw, sinceMs, encoding);
+      break;
+    case HISTORY_1MIN:
+      printBuckets(out, minutes, MINUTE_MS, sinceMs, encoding);
+      break;
+    case HISTORY_15MIN:
+      printBuckets(out, quarters, QUARTER_MS, sinceMs, encoding);
+      break;
+    }
+  }
+
+  size_t measure(ThingHistoryResolution resolution, int64_t sinceMs,
+                 ThingEncoding encoding = THING_ENCODING_JSON)
+  {
+    ThingCountingPrint counter;
+    print(counter, resolution, sinceMs, encoding);
+    return counter.count();
+  }
+
+  // "raw", "1m" or "15m"; anything else is raw
+  static ThingHistoryResolution parseResolution(const char *s, size_t len)
+  {
+    if (len == 2 && memcmp(s, "1m", 2) == 0)
+    {
+      return HISTORY_1MIN;
+    }
+    if (len == 3 && memcmp(s, "15m", 3) == 0)
+    {
+      return HISTORY_15MIN;
+    }
+    return HISTORY_RAW;
+  }
+
+private:
+  // bucket widths
+  static const int64_t MINUTE_MS = 60000;
+  static const int64_t QUARTER_MS = 900000;
+
+  ThingRing<ThingHistorySample, THING_HISTORY_RAW_CAPACITY> raw;
+  ThingRing<ThingHistoryBucket, THING_HISTORY_MINUTE_CAPACITY> minutes;
+  ThingRing<ThingHistoryBucket, THING_HISTORY_QUARTER_CAPACITY> quarters;
+
+  template <size_t N>
+  static void accumulate(ThingRing<ThingHistoryBucket, N> &buckets, int64_t periodMs,
+                         int64_t timeMs, double value)
+  {
+    int64_t startMs = timeMs - timeMs % periodMs;
+
+    if (buckets.size() > 0 && buckets.back().startMs == startMs)
+    {
+      ThingHistoryBucket &bucket = buckets.back();
+      bucket.min = value < bucket.min ? value : bucket.min;
+      bucket.max = value > bucket.max ? value : bucket.max;
+      bucket.sum += value;
+      bucket.count++;
+      return;
+    }
+
+    // late samples for an already closed bucket are only kept raw
+    if (buckets.size() > 0 && startMs < buckets.back().startMs)
+    {
+      return;
+    }
+
+    ThingHistoryBucket bucket = {startMs, value, value, value, 1};
+    buckets.push(bucket);
+  }
+
+  static void printArrayStart(Print &out, size_t size, ThingEncoding encoding)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_array(out, size);
+    }
+    else
+    {
+      out.write('[');
+    }
+  }
+
+  static void printArrayEnd(Print &out, ThingEncoding encoding)
+  {
+    if (encoding == THING_ENCODING_JSON)
+    {
+      out.write(']');
+    }
+  }
+
+  static void printSeparator(Print &out, size_t i, ThingEncoding encoding)
+  {
+    if (encoding == THING_ENCODING_JSON && i > 0)
+    {
+      out.write(',');
+    }
+  }
+
+  static void printInt(Print &out, int64_t v, ThingEncoding encoding)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_int(out, v);
+      return;
+    }
+    char digits[24];
+    out.write((const uint8_t *)digits, thing_format_int64(digits, v));
+  }
+
+  static void printDouble(Print &out, double v, ThingEncoding encoding)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_double(out, v);
+      return;
+    }
+    char digits[32];
+    out.write((const uint8_t *)digits, thing_format_double(digits, v));
+  }
+
+  template <size_t N>
+  static void printSamples(Print &out, ThingRing<ThingHistorySample, N> &ring,
+                           int64_t sinceMs, ThingEncoding encoding)
+  {
+    size_t first = 0;
+    while (first < ring.size() && ring.at(first).timeMs <= sinceMs)
+    {
+      first++;
+    }
+
+    printArrayStart(out, ring.size() - first, encoding);
+    for (size_t i = first; i < ring.size(); i++)
+    {
+      ThingHistorySample &sample = ring.at(i);
+      printSeparator(out, i - first, encoding);
+      printArrayStart(out, 2, encoding);
+      printInt(out, sample.timeMs, encoding);
+      printSeparator(out, 1, encoding);
+      printDouble(out, sample.value, encoding);
+      printArrayEnd(out, encoding);
+    }
+    printArrayEnd(out, encoding);
+  }
+
+  template <size_t N>
+  static void printBuckets(Print &out, ThingRing<ThingHistoryBucket, N> &ring,
+                           int64_t widthMs, int64_t sinceMs, ThingEncoding encoding)
+  {
+    size_t first = 0;
+    while (first < ring.size() && ring.at(first).startMs + widthMs <= sinceMs)
+    {
+      first++;
+    }
+
+    printArrayStart(out, ring.size() - first, encoding);
+    for (size_t i = first; i < ring.size(); i++)
+    {
+      ThingHistoryBucket &bucket = ring.at(i);
+      printSeparator(out, i - first, encoding);
+      printArrayStart(out, 5, encoding);
+      printInt(out, bucket.startMs, encoding);
+      printSeparator(out, 1, encoding);
+      printDouble(out, bucket.min, encoding);
+      printSeparator(out, 1, encoding);
+      printDouble(out, bucket.max, encoding);
+      printSeparator(out, 1, encoding);
+      printDouble(out, bucket.sum / bucket.count, encoding);
+      printSeparator(out, 1, encoding);
+      printInt(out, bucket.count, encoding);
+      printArrayEnd(out, encoding);
+    }
+    printArrayEnd(out, encoding);
+  }
+};
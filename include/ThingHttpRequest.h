@@ -0,0 +1,422 @@
+/**
+ * ThingHttpRequest.h
+ *
+ * Incremental HTTP/1.1 request parser over one fixed buffer. Bytes are read
+ * from the socket in blocks straight into the buffer; once the head is
+ * complete the request line and the headers of interest are recorded as
+ * offsets into it and NUL terminated in place, and the body is complete
+ * when Content-Length bytes have followed the head. Nothing is allocated.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// request line, headers and body together
+#ifndef THING_HTTP_REQUEST_SIZE
+#define THING_HTTP_REQUEST_SIZE 1024
+#endif
+
+enum ThingHttpParseState
+{
+  THING_HTTP_HEAD,
+  THING_HTTP_BODY,
+  THING_HTTP_COMPLETE,
+  THING_HTTP_ERROR
+};
+
+// a NUL terminated part of the request buffer
+struct ThingHttpSpan
+{
+  size_t offset = 0;
+  size_t length = 0;
+};
+
+inline bool thing_http_equals_ignore_case(const char *a, size_t len, const char *b)
+{
+  for (size_t i = 0; i < len; i++, b++)
+  {
+    char ca = a[i] >= 'A' && a[i] <= 'Z' ? a[i] + ('a' - 'A') : a[i];
+    char cb = *b >= 'A' && *b <= 'Z' ? *b + ('a' - 'A') : *b;
+    if (cb == '\0' || ca != cb)
+    {
+      return false;
+    }
+  }
+  return *b == '\0';
+}
+
+inline const char *thing_http_reason(int status)
+{
+  switch (status)
+  {
+  case 200:
+    return "OK";
+  case 201:
+    return "Created";
+  case 204:
+    return "No Content";
+  case 400:
+    return "Bad Request";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 413:
+    return "Payload Too Large";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 501:
+    return "Not Implemented";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "Error";
+  }
+}
+
+class ThingHttpRequest
+{
+public:
+  ThingHttpRequest() { reset(); }
+
+  /**
+   * Where the next bytes from the socket go; *room is how many fit. Read
+   * into it, then pass the count to received().
+   */
+  char *space(size_t *room)
+  {
+    *room = THING_HTTP_REQUEST_SIZE - length;
+    return buffer + length;
+  }
+
+  // parses as far as the n bytes just written to space() allow
+  ThingHttpParseState received(size_t n)
+  {
+    length += n;
+    if (state == THING_HTTP_HEAD)
+    {
+      scanHead();
+    }
+    if (state == THING_HTTP_BODY && length - bodySpan.offset >= bodySpan.length)
+    {
+      // may be the first byte of a pipelined request, see next()
+      endByte = buffer[bodySpan.offset + bodySpan.length];
+      buffer[bodySpan.offset + bodySpan.length] = '\0';
+      state = THING_HTTP_COMPLETE;
+    }
+    return state;
+  }
+
+  /**
+   * Drops the completed request and parses what the client sent after it,
+   * i.e. the next pipelined request, as far as it has arrived.
+   */
+  ThingHttpParseState next()
+  {
+    size_t end = bodySpan.offset + bodySpan.length;
+    buffer[end] = endByte;
+    size_t rest = length - end;
+    memmove(buffer, buffer + end, rest);
+    reset();
+    return rest > 0 ? received(rest) : state;
+  }
+
+  // some bytes of a request have been received
+  bool pending() const { return length > 0; }
+
+  ThingHttpParseState getState() const { return state; }
+
+  // the response status for a request that could not be parsed
+  int errorStatus() const { return status; }
+
+  const char *method() const { return str(methodSpan); }
+  // the path, without the query
+  const char *uri() const { return str(uriSpan); }
+  size_t uriLength() const { return uriSpan.length; }
+  // after the '?', "" if there is none
+  const char *query() const { return str(querySpan); }
+  const char *host() const { return str(hostSpan); }
+  size_t hostLength() const { return hostSpan.length; }
+  const char *accept() const { return str(acceptSpan); }
+  const char *ifNoneMatch() const { return str(ifNoneMatchSpan); }
+  // HTTP/1.1 unless "Connection: close", HTTP/1.0 only with "keep-alive"
+  bool keepAlive() const { return persistent; }
+  // the client understands chunked responses
+  bool http11() const { return version11; }
+  // Content-Length bytes, NUL terminated
+  const char *body() const { return str(bodySpan); }
+  size_t bodyLength() const { return bodySpan.length; }
+
+  void reset()
+  {
+    state = THING_HTTP_HEAD;
+    status = 0;
+    length = 0;
+    scanned = 0;
+    lineStart = 0;
+    headStarted = false;
+    persistent = false;
+    version11 = false;
+    methodSpan = ThingHttpSpan();
+    uriSpan = ThingHttpSpan();
+    querySpan = ThingHttpSpan();
+    hostSpan = ThingHttpSpan();
+    acceptSpan = ThingHttpSpan();
+    ifNoneMatchSpan = ThingHttpSpan();
+    bodySpan = ThingHttpSpan();
+  }
+
+private:
+  // one more for the NUL after a body that fills the buffer
+  char buffer[THING_HTTP_REQUEST_SIZE + 1];
+  size_t length;
+  // head bytes already searched for the empty line
+  size_t scanned;
+  size_t lineStart;
+  bool headStarted;
+  bool persistent;
+  bool version11;
+  char endByte;
+  ThingHttpParseState state;
+  int status;
+  ThingHttpSpan methodSpan;
+  ThingHttpSpan uriSpan;
+  ThingHttpSpan querySpan;
+  ThingHttpSpan hostSpan;
+  ThingHttpSpan acceptSpan;
+  ThingHttpSpan ifNoneMatchSpan;
+  ThingHttpSpan bodySpan;
+
+  const char *str(const ThingHttpSpan &span) const
+  {
+    return span.length > 0 ? buffer + span.offset : "";
+  }
+
+  void fail(int status_)
+  {
+    state = THING_HTTP_ERROR;
+    status = status_;
+  }
+
+  // looks for the empty line ending the head in the bytes not seen yet
+  void scanHead()
+  {
+    for (; scanned < length; scanned++)
+    {
+      if (buffer[scanned] != '\n')
+      {
+        continue;
+      }
+
+      size_t lineEnd = scanned > lineStart && buffer[scanned - 1] == '\r' ? scanned - 1 : scanned;
+      bool empty = lineEnd == lineStart;
+      lineStart = scanned + 1;
+      if (!empty)
+      {
+        headStarted = true;
+        continue;
+      }
+      // empty lines before the request line are allowed
+      if (!headStarted)
+      {
+        continue;
+      }
+
+      parseHead(scanned + 1);
+      return;
+    }
+
+    if (length == THING_HTTP_REQUEST_SIZE)
+    {
+      fail(431);
+    }
+  }
+
+  // the head is buffer[0, headEnd), its last line empty
+  void parseHead(size_t headEnd)
+  {
+    size_t pos = 0;
+    while (buffer[pos] == '\r' || buffer[pos] == '\n')
+    {
+      pos++;
+    }
+
+    size_t lineEnd = endOfLine(pos);
+    if (!parseRequestLine(pos, lineEnd))
+    {
+      fail(400);
+      return;
+    }
+
+    size_t contentLength = 0;
+    for (pos = lineEnd + 1; pos < headEnd; pos = lineEnd + 1)
+    {
+      lineEnd = endOfLine(pos);
+      size_t end = lineEnd > pos && buffer[lineEnd - 1] == '\r' ? lineEnd - 1 : lineEnd;
+      if (end == pos)
+      {
+        break;
+      }
+
+      char *colon = (char *)memchr(buffer + pos, ':', end - pos);
+      if (colon == nullptr)
+      {
+        fail(400);
+        return;
+      }
+      size_t nameLen = colon - (buffer + pos);
+      ThingHttpSpan value = trim(colon + 1 - buffer, end);
+      const char *name = buffer + pos;
+      *colon = '\0';
+
+      if (thing_http_equals_ignore_case(name, nameLen, "host"))
+      {
+        hostSpan = value;
+      }
+      else if (thing_http_equals_ignore_case(name, nameLen, "accept"))
+      {
+        acceptSpan = value;
+      }
+      else if (thing_http_equals_ignore_case(name, nameLen, "if-none-match"))
+      {
+        ifNoneMatchSpan = value;
+      }
+      else if (thing_http_equals_ignore_case(name, nameLen, "content-length"))
+      {
+        const char *digits = buffer + value.offset;
+        char *digitsEnd;
+        unsigned long n = strtoul(digits, &digitsEnd, 10);
+        if (value.length == 0 || *digits < '0' || *digits > '9' ||
+            digitsEnd != digits + value.length)
+        {
+          fail(400);
+          return;
+        }
+        contentLength = n;
+      }
+      else if (thing_http_equals_ignore_case(name, nameLen, "connection"))
+      {
+        if (hasToken(value, "close"))
+        {
+          persistent = false;
+        }
+        else if (hasToken(value, "keep-alive"))
+        {
+          persistent = true;
+        }
+      }
+      else if (thing_http_equals_ignore_case(name, nameLen, "transfer-encoding"))
+      {
+        // chunked request bodies are not supported
+        fail(501);
+        return;
+      }
+    }
+
+    if (contentLength > THING_HTTP_REQUEST_SIZE - headEnd)
+    {
+      fail(413);
+      return;
+    }
+    bodySpan.offset = headEnd;
+    bodySpan.length = contentLength;
+    state = THING_HTTP_BODY;
+  }
+
+  // "<method> <target> HTTP/1.x"
+  bool parseRequestLine(size_t pos, size_t lineEnd)
+  {
+    char *line = buffer + pos;
+    char *end = buffer + lineEnd;
+    char *methodEnd = (char *)memchr(line, ' ', end - line);
+    if (methodEnd == nullptr || methodEnd == line)
+    {
+      return false;
+    }
+    char *target = methodEnd + 1;
+    char *targetEnd = (char *)memchr(target, ' ', end - target);
+    if (targetEnd == nullptr || targetEnd == target)
+    {
+      return false;
+    }
+
+    methodSpan.offset = pos;
+    methodSpan.length = methodEnd - line;
+    *methodEnd = '\0';
+
+    char *question = (char *)memchr(target, '?', targetEnd - target);
+    char *pathEnd = question != nullptr ? question : targetEnd;
+    uriSpan.offset = target - buffer;
+    uriSpan.length = pathEnd - target;
+    if (question != nullptr)
+    {
+      querySpan.offset = question + 1 - buffer;
+      querySpan.length = targetEnd - (question + 1);
+    }
+    *pathEnd = '\0';
+    *targetEnd = '\0';
+
+    const char *version = targetEnd + 1;
+    version11 = end - version >= 8 && memcmp(version, "HTTP/1.1", 8) == 0;
+    persistent = version11;
+    return true;
+  }
+
+  // value is a comma separated list containing token
+  bool hasToken(const ThingHttpSpan &value, const char *token) const
+  {
+    const char *item = buffer + value.offset;
+    const char *end = item + value.length;
+    while (item < end)
+    {
+      const char *comma = (const char *)memchr(item, ',', end - item);
+      const char *itemEnd = comma != nullptr ? comma : end;
+      const char *last = itemEnd;
+      while (item < last && *item == ' ')
+      {
+        item++;
+      }
+      while (last > item && last[-1] == ' ')
+      {
+        last--;
+      }
+      if (thing_http_equals_ignore_case(item, last - item, token))
+      {
+        return true;
+      }
+      item = itemEnd + 1;
+    }
+    return false;
+  }
+
+  // index of the '\n' ending the line at pos
+  size_t endOfLine(size_t pos)
+  {
+    return (char *)memchr(buffer + pos, '\n', length - pos) - buffer;
+  }
+
+  // the value in [start, end) without surrounding blanks, NUL terminated
+  ThingHttpSpan trim(size_t start, size_t end)
+  {
+    while (start < end && (buffer[start] == ' ' || buffer[start] == '\t'))
+    {
+      start++;
+    }
+    while (end > start && (buffer[end - 1] == ' ' || buffer[end - 1] == '\t'))
+    {
+      end--;
+    }
+    buffer[end] = '\0';
+    ThingHttpSpan span;
+    span.offset = start;
+    span.length = end - start;
+    return span;
+  }
+};
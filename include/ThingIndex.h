@@ -0,0 +1,167 @@
+/**
+ * ThingIndex.h
+ *
+ * Flat, sorted pointer index over objects carrying a `String id` member.
+ * ThingDevice keeps one per registered kind (properties, actions, events,
+ * action objects) so lookups by id are a binary search instead of a walk
+ * over the linked lists.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+template <class T>
+class ThingIndex
+{
+public:
+  ThingIndex() {}
+  ThingIndex(const ThingIndex &) = delete;
+  ThingIndex &operator=(const ThingIndex &) = delete;
+
+  ~ThingIndex()
+  {
+    free(items);
+  }
+
+  T *find(const char *id) const
+  {
+    return find(id, strlen(id));
+  }
+
+  // Lookup by a (pointer, length) key so callers can search with a slice of
+  // a larger buffer (URI, MQTT topic) without copying it first.
+  T *find(const char *id, size_t len) const
+  {
+    size_t pos = upperBound(id, len);
+    if (pos > 0 && compare(items[pos - 1], id, len) == 0)
+    {
+      return items[pos - 1];
+    }
+    return nullptr;
+  }
+
+  // Items registered later with an already known id shadow the earlier one,
+  // the same way the linked lists return the most recently added match.
+  // Both stay indexed, so removing the later one uncovers the earlier.
+  bool insert(T *item)
+  {
+    const char *id = item->id.c_str();
+    size_t len = item->id.length();
+    size_t pos = upperBound(id, len);
+    for (size_t i = lowerBound(id, len); i < pos; i++)
+    {
+      if (items[i] == item)
+      {
+        return true;
+      }
+    }
+
+    if (count == capacity && !grow())
+    {
+      return false;
+    }
+
+    memmove(items + pos + 1, items + pos, (count - pos) * sizeof(T *));
+    items[pos] = item;
+    count++;
+    return true;
+  }
+
+  bool remove(T *item)
+  {
+    const char *id = item->id.c_str();
+    size_t len = item->id.length();
+    size_t pos = lowerBound(id, len);
+    while (pos < count && items[pos] != item && compare(items[pos], id, len) == 0)
+    {
+      pos++;
+    }
+
+    if (pos >= count || items[pos] != item)
+    {
+      return false;
+    }
+
+    memmove(items + pos, items + pos + 1, (count - pos - 1) * sizeof(T *));
+    count--;
+    return true;
+  }
+
+  size_t size() const { return count; }
+
+  T *at(size_t i) const { return items[i]; }
+
+private:
+  T **items = nullptr;
+  size_t count = 0;
+  size_t capacity = 0;
+
+  // Orders by length first so most comparisons never touch the bytes.
+  static int compare(const T *item, const char *id, size_t len)
+  {
+    size_t itemLen = item->id.length();
+    if (itemLen != len)
+    {
+      return itemLen < len ? -1 : 1;
+    }
+    return memcmp(item->id.c_str(), id, len);
+  }
+
+  size_t lowerBound(const char *id, size_t len) const
+  {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (compare(items[mid], id, len) < 0)
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  // first entry ordered after id, i.e. past all entries with that id
+  size_t upperBound(const char *id, size_t len) const
+  {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (compare(items[mid], id, len) <= 0)
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  bool grow()
+  {
+    size_t newCapacity = capacity == 0 ? 4 : capacity * 2;
+    T **grown = (T **)realloc(items, newCapacity * sizeof(T *));
+    if (grown == nullptr)
+    {
+      return false;
+    }
+    items = grown;
+    capacity = newCapacity;
+    return true;
+  }
+};
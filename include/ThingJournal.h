@@ -0,0 +1,448 @@
+/**
+ * ThingJournal.h
+ *
+ * Store-and-forward journal: QoS1 publishes made while the broker is
+ * unreachable are appended to segment files on SPIFFS and replayed in
+ * order, at a limited rate, once the connection is back. A segment is
+ * deleted when it has been read completely and every message replayed
+ * from it has been acknowledged by the broker.
+ *
+ * Replayed messages are not retained, so they never overwrite the current
+ * value on a retained topic; subscribers order them by their "time". The
+ * latest offline message per topic is also kept by the outbox, which sends
+ * it retained on reconnect and reports it through delivered(); replay
+ * skips those records so nothing is delivered twice.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "filefunctions.h"
+#include "mqtt_client.h"
+
+#include "ThingMQTTOutbox.h"
+#include "ThingPlatform.h"
+#include "ThingStream.h"
+
+#define THING_JOURNAL_DIR "/journal"
+
+// segments are closed once they reach this size
+#ifndef THING_JOURNAL_SEGMENT_SIZE
+#define THING_JOURNAL_SEGMENT_SIZE 4096
+#endif
+
+// oldest segment is discarded beyond this, bounding flash use
+#ifndef THING_JOURNAL_MAX_SEGMENTS
+#define THING_JOURNAL_MAX_SEGMENTS 32
+#endif
+
+#ifndef THING_JOURNAL_REPLAY_PER_SECOND
+#define THING_JOURNAL_REPLAY_PER_SECOND 10
+#endif
+
+// replayed messages awaiting their PUBACK
+#ifndef THING_JOURNAL_INFLIGHT
+#define THING_JOURNAL_INFLIGHT 8
+#endif
+
+#ifndef THING_JOURNAL_TOPIC_SIZE
+#define THING_JOURNAL_TOPIC_SIZE 96
+#endif
+
+// as large as an outbox slot, so every message the outbox holds fits
+#ifndef THING_JOURNAL_PAYLOAD_SIZE
+#define THING_JOURNAL_PAYLOAD_SIZE THING_OUTBOX_PAYLOAD_SIZE
+#endif
+
+// journaled messages the outbox delivered and replay has yet to skip
+#ifndef THING_JOURNAL_DELIVERED
+#define THING_JOURNAL_DELIVERED THING_OUTBOX_SLOTS
+#endif
+
+struct ThingJournalStats
+{
+  uint32_t appended = 0;
+  uint32_t replayed = 0;
+  uint32_t acknowledged = 0;
+  // records not replayed because the outbox delivered them
+  uint32_t skipped = 0;
+  // segments discarded unreplayed because the journal was full
+  uint32_t droppedSegments = 0;
+  // records that did not fit the record buffers or could not be written
+  uint32_t failed = 0;
+  uint32_t segments = 0;
+};
+
+class ThingJournal
+{
+public:
+  /**
+   * Mounts SPIFFS and picks up segments left over from before a reboot;
+   * those are replayed from their start.
+   */
+  bool begin(esp_mqtt_client_handle_t client_)
+  {
+    client = client_;
+    if (!SPIFFS.begin(true))
+    {
+      return false;
+    }
+
+    ThingLock lock(mutex);
+    File dir = SPIFFS.open(THING_JOURNAL_DIR);
+    if (dir)
+    {
+      File file = dir.openNextFile();
+      while (file)
+      {
+        // name() is the full path on older cores, the base name on newer ones
+        const char *name = file.name();
+        const char *slash = strrchr(name, '/');
+        uint32_t segment = strtoul(slash != nullptr ? slash + 1 : name, nullptr, 10);
+        if (segment > 0)
+        {
+          if (!hasSegments || segment < firstSegment)
+          {
+            firstSegment = segment;
+          }
+          if (!hasSegments || segment > lastSegment)
+          {
+            lastSegment = segment;
+            lastSegmentSize = file.size();
+          }
+          hasSegments = true;
+        }
+        file = dir.openNextFile();
+      }
+    }
+    readSegment = firstSegment;
+    readOffset = 0;
+    return true;
+  }
+
+  void setReplayRate(uint16_t messagesPerSecond)
+  {
+    replayIntervalMs = messagesPerSecond > 0 ? 1000 / messagesPerSecond : 0;
+  }
+
+  /**
+   * Appends one message. Record layout: topic length and payload length as
+   * little endian uint16, then topic and payload bytes.
+   */
+  bool append(const char *topic, const char *payload, size_t len)
+  {
+    size_t topicLen = strlen(topic);
+    if (topicLen >= THING_JOURNAL_TOPIC_SIZE || len > THING_JOURNAL_PAYLOAD_SIZE)
+    {
+      stats.failed++;
+      return false;
+    }
+
+    uint8_t record[4 + THING_JOURNAL_TOPIC_SIZE + THING_JOURNAL_PAYLOAD_SIZE];
+    record[0] = (uint8_t)topicLen;
+    record[1] = (uint8_t)(topicLen >> 8);
+    record[2] = (uint8_t)len;
+    record[3] = (uint8_t)(len >> 8);
+    memcpy(record + 4, topic, topicLen);
+    memcpy(record + 4 + topicLen, payload, len);
+    size_t recordLen = 4 + topicLen + len;
+
+    ThingLock lock(mutex);
+    if (!hasSegments || lastSegmentSize + recordLen > THING_JOURNAL_SEGMENT_SIZE)
+    {
+      openSegment();
+    }
+
+    char path[32];
+    segmentPath(path, lastSegment);
+    if (appendFileBytes(SPIFFS, path, record, recordLen) != recordLen)
+    {
+      stats.failed++;
+      return false;
+    }
+    lastSegmentSize += recordLen;
+    stats.appended++;
+    return true;
+  }
+
+  /**
+   * Replays the next record if the rate limit allows; call from the main
+   * loop while connected. Returns true while there is journal left.
+   */
+  bool replay(uint32_t now)
+  {
+    ThingLock lock(mutex);
+    if (!hasSegments)
+    {
+      return false;
+    }
+    if (now - lastReplayMs < replayIntervalMs || inflightCount == THING_JOURNAL_INFLIGHT)
+    {
+      return true;
+    }
+
+    char topic[THING_JOURNAL_TOPIC_SIZE];
+    char payload[THING_JOURNAL_PAYLOAD_SIZE];
+    size_t len;
+    size_t recordLen = readRecord(topic, payload, &len);
+    if (recordLen == 0)
+    {
+      // end of the segment being read
+      if (readSegment < lastSegment)
+      {
+        readSegment++;
+        readOffset = 0;
+      }
+      else
+      {
+        // also skips a truncated tail (power loss during an append); new
+        // records go to a fresh segment
+        readOffset = lastSegmentSize = THING_JOURNAL_SEGMENT_SIZE;
+      }
+      recycle();
+      return hasSegments;
+    }
+
+    if (takeDelivered(topic, payload, len))
+    {
+      readOffset += recordLen;
+      stats.skipped++;
+      return true;
+    }
+
+    int msgId = esp_mqtt_client_enqueue(client, topic, payload, len, 1, 0, true);
+    if (msgId < 0)
+    {
+      return true;
+    }
+
+    inflight[inflightCount].msgId = msgId;
+    inflight[inflightCount].segment = readSegment;
+    inflightCount++;
+    readOffset += recordLen;
+    lastReplayMs = now;
+    stats.replayed++;
+    return true;
+  }
+
+  /**
+   * The outbox sent a message that was also journaled; its record is
+   * skipped when replay reaches it. Called from the outbox sender task.
+   */
+  void delivered(const char *topic, const char *payload, size_t len)
+  {
+    ThingLock lock(mutex);
+    Delivered &entry = deliveredMessages[deliveredNext];
+    entry.hash = messageHash(topic, payload, len);
+    entry.len = len;
+    entry.used = true;
+    deliveredNext = (deliveredNext + 1) % THING_JOURNAL_DELIVERED;
+  }
+
+  // MQTT_EVENT_PUBLISHED, called from the MQTT task
+  void acknowledged(int msgId)
+  {
+    ThingLock lock(mutex);
+    for (size_t i = 0; i < inflightCount; i++)
+    {
+      if (inflight[i].msgId == msgId)
+      {
+        inflight[i] = inflight[--inflightCount];
+        stats.acknowledged++;
+        return;
+      }
+    }
+  }
+
+  /**
+   * The client may drop what it had in flight on a disconnect, so replay
+   * restarts at the oldest unacknowledged segment: delivery is at least
+   * once, with duplicates of at most one segment.
+   */
+  void connectionLost()
+  {
+    ThingLock lock(mutex);
+    if (inflightCount == 0)
+    {
+      return;
+    }
+
+    uint32_t oldest = inflight[0].segment;
+    for (size_t i = 1; i < inflightCount; i++)
+    {
+      oldest = inflight[i].segment < oldest ? inflight[i].segment : oldest;
+    }
+    inflightCount = 0;
+    readSegment = oldest;
+    readOffset = 0;
+  }
+
+  ThingJournalStats getStats()
+  {
+    ThingLock lock(mutex);
+    ThingJournalStats s = stats;
+    s.segments = hasSegments ? lastSegment - firstSegment + 1 : 0;
+    return s;
+  }
+
+private:
+  struct Inflight
+  {
+    int msgId;
+    uint32_t segment;
+  };
+
+  struct Delivered
+  {
+    uint32_t hash;
+    size_t len;
+    bool used;
+  };
+
+  esp_mqtt_client_handle_t client = nullptr;
+  bool hasSegments = false;
+  uint32_t firstSegment = 0;
+  uint32_t lastSegment = 0;
+  size_t lastSegmentSize = 0;
+  uint32_t readSegment = 0;
+  size_t readOffset = 0;
+  uint32_t replayIntervalMs = 1000 / THING_JOURNAL_REPLAY_PER_SECOND;
+  uint32_t lastReplayMs = 0;
+  Inflight inflight[THING_JOURNAL_INFLIGHT];
+  size_t inflightCount = 0;
+  // a ring, the oldest is forgotten (and replayed after all) when full
+  Delivered deliveredMessages[THING_JOURNAL_DELIVERED] = {};
+  size_t deliveredNext = 0;
+  ThingJournalStats stats;
+  ThingMutex mutex;
+
+  static void segmentPath(char *path, uint32_t segment)
+  {
+    snprintf(path, 32, THING_JOURNAL_DIR "/%lu", (unsigned long)segment);
+  }
+
+  // caller holds the mutex
+  void openSegment()
+  {
+    if (!hasSegments)
+    {
+      firstSegment = lastSegment = readSegment = 1;
+      readOffset = 0;
+      hasSegments = true;
+    }
+    else
+    {
+      lastSegment++;
+    }
+    lastSegmentSize = 0;
+
+    if (lastSegment - firstSegment + 1 > THING_JOURNAL_MAX_SEGMENTS)
+    {
+      char path[32];
+      segmentPath(path, firstSegment);
+      SPIFFS.remove(path);
+      stats.droppedSegments++;
+      if (readSegment == firstSegment)
+      {
+        readSegment++;
+        readOffset = 0;
+      }
+      firstSegment++;
+    }
+  }
+
+  // caller holds the mutex; returns the record length, 0 at the end
+  size_t readRecord(char *topic, char *payload, size_t *len)
+  {
+    char path[32];
+    segmentPath(path, readSegment);
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file || !file.seek(readOffset))
+    {
+      return 0;
+    }
+
+    uint8_t header[4];
+    if (file.read(header, 4) != 4)
+    {
+      return 0;
+    }
+    size_t topicLen = header[0] | (header[1] << 8);
+    *len = header[2] | (header[3] << 8);
+    if (topicLen >= THING_JOURNAL_TOPIC_SIZE || *len > THING_JOURNAL_PAYLOAD_SIZE ||
+        file.read((uint8_t *)topic, topicLen) != topicLen ||
+        file.read((uint8_t *)payload, *len) != *len)
+    {
+      // truncated or corrupt tail, e.g. power loss during an append
+      return 0;
+    }
+    topic[topicLen] = '\0';
+    return 4 + topicLen + *len;
+  }
+
+  static uint32_t messageHash(const char *topic, const char *payload, size_t len)
+  {
+    uint32_t hash = thing_fnv1a(THING_FNV1A_OFFSET, (const uint8_t *)topic, strlen(topic) + 1);
+    return thing_fnv1a(hash, (const uint8_t *)payload, len);
+  }
+
+  // caller holds the mutex; forgets and returns true if the outbox sent it
+  bool takeDelivered(const char *topic, const char *payload, size_t len)
+  {
+    uint32_t hash = messageHash(topic, payload, len);
+    for (size_t i = 0; i < THING_JOURNAL_DELIVERED; i++)
+    {
+      Delivered &entry = deliveredMessages[i];
+      if (entry.used && entry.hash == hash && entry.len == len)
+      {
+        entry.used = false;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // caller holds the mutex; deletes segments that are read and acknowledged
+  void recycle()
+  {
+    while (hasSegments && firstSegment <= readSegment)
+    {
+      bool fullyRead = firstSegment < readSegment ||
+                       (firstSegment == lastSegment && readRecordEnd());
+      if (!fullyRead || hasInflight(firstSegment))
+      {
+        return;
+      }
+
+      char path[32];
+      segmentPath(path, firstSegment);
+      SPIFFS.remove(path);
+      if (firstSegment == lastSegment)
+      {
+        hasSegments = false;
+        return;
+      }
+      firstSegment++;
+    }
+  }
+
+  bool readRecordEnd()
+  {
+    return readSegment == lastSegment && readOffset >= lastSegmentSize;
+  }
+
+  bool hasInflight(uint32_t segment)
+  {
+    for (size_t i = 0; i < inflightCount; i++)
+    {
+      if (inflight[i].segment == segment)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+};
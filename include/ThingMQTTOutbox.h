@@ -0,0 +1,342 @@
+/**
+ * ThingMQTTOutbox.h
+ *
+ * Bounded MQTT outbox: publishes are copied into fixed slots and sent by a
+ * dedicated task, so the caller (the metering loop) never waits for the
+ * network. A newer payload for a topic that is still queued replaces the
+ * queued one.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <string.h>
+
+#include "mqtt_client.h"
+
+#include "ThingPlatform.h"
+
+#if defined(THING_PLATFORM_FREERTOS)
+#include <freertos/task.h>
+#elif defined(THING_PLATFORM_HOST)
+#include <condition_variable>
+#include <thread>
+#endif
+
+#ifndef THING_OUTBOX_SLOTS
+#define THING_OUTBOX_SLOTS 8
+#endif
+
+#ifndef THING_OUTBOX_TOPIC_SIZE
+#define THING_OUTBOX_TOPIC_SIZE 96
+#endif
+
+// larger payloads (TDs, history) bypass the slots, see enqueue()
+#ifndef THING_OUTBOX_PAYLOAD_SIZE
+#define THING_OUTBOX_PAYLOAD_SIZE 512
+#endif
+
+// wait before retrying a publish the client refused
+#ifndef THING_OUTBOX_RETRY_MS
+#define THING_OUTBOX_RETRY_MS 1000
+#endif
+
+#ifndef THING_OUTBOX_STACK_SIZE
+#define THING_OUTBOX_STACK_SIZE 4096
+#endif
+
+#ifndef THING_OUTBOX_PRIORITY
+#define THING_OUTBOX_PRIORITY 1
+#endif
+
+struct ThingOutboxStats
+{
+  size_t depth = 0;
+  size_t highWater = 0;
+  uint32_t enqueued = 0;
+  // replaced by a newer payload for the same topic before being sent
+  uint32_t coalesced = 0;
+  // refused because all slots were taken
+  uint32_t dropped = 0;
+  uint32_t sent = 0;
+  // the client refused the publish (e.g. not connected), retried later
+  uint32_t failed = 0;
+  // enqueue to hand-over to the MQTT client, in microseconds
+  uint32_t lastLatencyUs = 0;
+  uint32_t maxLatencyUs = 0;
+  uint64_t totalLatencyUs = 0;
+};
+
+class ThingMQTTOutbox
+{
+public:
+  ThingMQTTOutbox() = default;
+  ThingMQTTOutbox(const ThingMQTTOutbox &) = delete;
+  ThingMQTTOutbox &operator=(const ThingMQTTOutbox &) = delete;
+
+  ~ThingMQTTOutbox()
+  {
+#if defined(THING_PLATFORM_HOST)
+    if (sender.joinable())
+    {
+      {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+      }
+      wake.notify_one();
+      sender.join();
+    }
+#endif
+  }
+
+  // Starts the sender task for the given client.
+  bool begin(esp_mqtt_client_handle_t client_)
+  {
+    client = client_;
+#if defined(THING_PLATFORM_FREERTOS)
+    if (task != nullptr)
+    {
+      return true;
+    }
+    return xTaskCreate(run, "thing_outbox", THING_OUTBOX_STACK_SIZE, this,
+                       THING_OUTBOX_PRIORITY, &task) == pdPASS;
+#elif defined(THING_PLATFORM_HOST)
+    if (!sender.joinable())
+    {
+      sender = std::thread([this]() { run(this); });
+    }
+    return true;
+#else
+    return true;
+#endif
+  }
+
+  /**
+   * Copies the message into a free slot and returns immediately. If the
+   * topic is already queued and not yet being sent, its payload is
+   * replaced instead. Returns false if the message was dropped because all
+   * slots are taken. Payloads larger than a slot go to the client's own
+   * outbox via esp_mqtt_client_enqueue(), which does not block either.
+   */
+  bool enqueue(const char *topic, const char *payload, size_t len, int qos, bool retain,
+               bool journaled = false)
+  {
+    size_t topicLen = strlen(topic);
+    if (topicLen >= THING_OUTBOX_TOPIC_SIZE || len > THING_OUTBOX_PAYLOAD_SIZE)
+    {
+      return esp_mqtt_client_enqueue(client, topic, payload, len, qos, retain, true) >= 0;
+    }
+
+    {
+      ThingLock lock(mutex);
+      stats.enqueued++;
+
+      Slot *slot = findQueued(topic);
+      if (slot != nullptr)
+      {
+        stats.coalesced++;
+      }
+      else if (count == THING_OUTBOX_SLOTS)
+      {
+        stats.dropped++;
+        return false;
+      }
+      else
+      {
+        slot = &slots[(head + count) % THING_OUTBOX_SLOTS];
+        memcpy(slot->topic, topic, topicLen + 1);
+        slot->enqueuedUs = thing_monotonic_us();
+        count++;
+        if (count > stats.highWater)
+        {
+          stats.highWater = count;
+        }
+      }
+
+      memcpy(slot->payload, payload, len);
+      slot->len = len;
+      slot->qos = qos;
+      slot->retain = retain;
+      slot->journaled = journaled;
+    }
+
+    notify();
+    return true;
+  }
+
+  /**
+   * Hands queued messages to the MQTT client, oldest first, until the
+   * outbox is empty or the client refuses one. Called by the sender task;
+   * returns the number of messages sent.
+   */
+  size_t drain()
+  {
+    size_t sentNow = 0;
+    for (;;)
+    {
+      Slot *slot;
+      {
+        ThingLock lock(mutex);
+        if (count == 0)
+        {
+          return sentNow;
+        }
+        slot = &slots[head];
+        sending = true;
+      }
+
+      // the slot is not modified while `sending` is set, so no lock here
+      int msgId = esp_mqtt_client_publish(client, slot->topic, slot->payload, slot->len,
+                                          slot->qos, slot->retain);
+      if (msgId >= 0 && slot->journaled && journaledSent != nullptr)
+      {
+        journaledSent(slot->topic, slot->payload, slot->len);
+      }
+
+      ThingLock lock(mutex);
+      sending = false;
+      if (msgId < 0)
+      {
+        stats.failed++;
+        return sentNow;
+      }
+
+      uint32_t latency = (uint32_t)(thing_monotonic_us() - slot->enqueuedUs);
+      stats.sent++;
+      stats.lastLatencyUs = latency;
+      stats.totalLatencyUs += latency;
+      if (latency > stats.maxLatencyUs)
+      {
+        stats.maxLatencyUs = latency;
+      }
+      head = (head + 1) % THING_OUTBOX_SLOTS;
+      count--;
+      sentNow++;
+    }
+  }
+
+  // Sending pauses while disconnected; reconnecting flushes the backlog.
+  void setConnected(bool connected_)
+  {
+    connected = connected_;
+    if (connected)
+    {
+      notify();
+    }
+  }
+
+  bool isConnected() const { return connected; }
+
+  /**
+   * Called from the sender task for every message enqueued as journaled
+   * once it has been handed to the client, see ThingJournal::delivered().
+   */
+  void setJournaledHook(void (*hook)(const char *topic, const char *payload, size_t len))
+  {
+    journaledSent = hook;
+  }
+
+  ThingOutboxStats getStats()
+  {
+    ThingLock lock(mutex);
+    ThingOutboxStats s = stats;
+    s.depth = count;
+    return s;
+  }
+
+private:
+  struct Slot
+  {
+    char topic[THING_OUTBOX_TOPIC_SIZE];
+    char payload[THING_OUTBOX_PAYLOAD_SIZE];
+    size_t len;
+    int64_t enqueuedUs;
+    uint8_t qos;
+    bool retain;
+    // also in the journal, see enqueue()
+    bool journaled;
+  };
+
+  esp_mqtt_client_handle_t client = nullptr;
+  Slot slots[THING_OUTBOX_SLOTS];
+  size_t head = 0;
+  size_t count = 0;
+  // the head slot is being published
+  bool sending = false;
+  volatile bool connected = false;
+  void (*journaledSent)(const char *topic, const char *payload, size_t len) = nullptr;
+  ThingOutboxStats stats;
+  ThingMutex mutex;
+
+#if defined(THING_PLATFORM_FREERTOS)
+  TaskHandle_t task = nullptr;
+#elif defined(THING_PLATFORM_HOST)
+  std::mutex wakeMutex;
+  std::condition_variable wake;
+  std::thread sender;
+  bool woken = false;
+  bool stopping = false;
+#endif
+
+  // caller holds the mutex
+  Slot *findQueued(const char *topic)
+  {
+    for (size_t i = sending ? 1 : 0; i < count; i++)
+    {
+      Slot *slot = &slots[(head + i) % THING_OUTBOX_SLOTS];
+      if (strcmp(slot->topic, topic) == 0)
+      {
+        return slot;
+      }
+    }
+    return nullptr;
+  }
+
+  void notify()
+  {
+#if defined(THING_PLATFORM_FREERTOS)
+    if (task != nullptr)
+    {
+      xTaskNotifyGive(task);
+    }
+#elif defined(THING_PLATFORM_HOST)
+    {
+      std::lock_guard<std::mutex> lock(wakeMutex);
+      woken = true;
+    }
+    wake.notify_one();
+#endif
+  }
+
+  static void run(void *arg)
+  {
+    ThingMQTTOutbox *self = (ThingMQTTOutbox *)arg;
+    for (;;)
+    {
+#if defined(THING_PLATFORM_FREERTOS)
+      // wakes on enqueue/reconnect, or to retry a refused publish
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(THING_OUTBOX_RETRY_MS));
+#elif defined(THING_PLATFORM_HOST)
+      {
+        std::unique_lock<std::mutex> lock(self->wakeMutex);
+        self->wake.wait_for(lock, std::chrono::milliseconds(THING_OUTBOX_RETRY_MS),
+                            [self]() { return self->woken || self->stopping; });
+        if (self->stopping)
+        {
+          return;
+        }
+        self->woken = false;
+      }
+#else
+      return;
+#endif
+      if (self->connected)
+      {
+        self->drain();
+      }
+    }
+  }
+};
@@ -0,0 +1,149 @@
+/**
+ * ThingPlatform.h
+ *
+ * Clock, time formatting and locking helpers shared by the Thing classes,
+ * with an ESP32 (FreeRTOS), a host and a single threaded Arduino
+ * implementation.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#if defined(ESP32)
+#define THING_PLATFORM_FREERTOS 1
+#elif !defined(ARDUINO)
+#define THING_PLATFORM_HOST 1
+#endif
+
+#if defined(ESP32)
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#else
+#include <chrono>
+#endif
+
+#if defined(THING_PLATFORM_HOST)
+#include <mutex>
+#endif
+
+// Wall clock in milliseconds since the Unix epoch (NTP synced on target).
+inline int64_t thing_epoch_ms()
+{
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// Monotonic microseconds; on ESP32 this is esp_timer, which is safe to read
+// from an ISR.
+inline int64_t thing_monotonic_us()
+{
+#if defined(ESP32)
+  return esp_timer_get_time();
+#else
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// 32 random bits; the hardware RNG on ESP32, which differs between devices
+// even right after boot, rand() elsewhere.
+inline uint32_t thing_random()
+{
+#if defined(ESP32)
+  return esp_random();
+#else
+  return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+#endif
+}
+
+// Converts a thing_monotonic_us() sample taken earlier (e.g. in an ISR) to
+// epoch milliseconds.
+inline int64_t thing_timer_to_epoch_ms(int64_t monotonicUs)
+{
+  return thing_epoch_ms() - (thing_monotonic_us() - monotonicUs) / 1000;
+}
+
+// Formats epoch milliseconds as "YYYY-MM-DDTHH:MM:SS+00:00" (26 bytes
+// including the NUL), the format of the Web Thing API action timestamps.
+inline void thing_format_iso8601(char *buf, int64_t epochMs)
+{
+  time_t seconds = (time_t)(epochMs / 1000);
+  struct tm t;
+  gmtime_r(&seconds, &t);
+  strftime(buf, 26, "%Y-%m-%dT%H:%M:%S+00:00", &t);
+}
+
+/**
+ * Non-recursive mutex: a FreeRTOS mutex on ESP32, std::mutex on a host
+ * build and a no-op on single threaded Arduino targets. Not for ISRs.
+ */
+class ThingMutex
+{
+public:
+  ThingMutex() = default;
+  ThingMutex(const ThingMutex &) = delete;
+  ThingMutex &operator=(const ThingMutex &) = delete;
+
+  void lock()
+  {
+#if defined(THING_PLATFORM_FREERTOS)
+    // created on first use, so static instances make no FreeRTOS calls
+    // during static initialisation
+    if (handle == nullptr)
+    {
+      portENTER_CRITICAL(&createLock);
+      if (handle == nullptr)
+      {
+        handle = xSemaphoreCreateMutexStatic(&storage);
+      }
+      portEXIT_CRITICAL(&createLock);
+    }
+    xSemaphoreTake(handle, portMAX_DELAY);
+#elif defined(THING_PLATFORM_HOST)
+    m.lock();
+#endif
+  }
+
+  void unlock()
+  {
+#if defined(THING_PLATFORM_FREERTOS)
+    xSemaphoreGive(handle);
+#elif defined(THING_PLATFORM_HOST)
+    m.unlock();
+#endif
+  }
+
+private:
+#if defined(THING_PLATFORM_FREERTOS)
+  SemaphoreHandle_t handle = nullptr;
+  StaticSemaphore_t storage;
+  portMUX_TYPE createLock = portMUX_INITIALIZER_UNLOCKED;
+#elif defined(THING_PLATFORM_HOST)
+  std::mutex m;
+#endif
+};
+
+// Scoped lock for ThingMutex.
+class ThingLock
+{
+public:
+  explicit ThingLock(ThingMutex &m_) : m(m_) { m.lock(); }
+  ~ThingLock() { m.unlock(); }
+  ThingLock(const ThingLock &) = delete;
+  ThingLock &operator=(const ThingLock &) = delete;
+
+private:
+  ThingMutex &m;
+};
@@ -0,0 +1,210 @@
+/**
+ * ThingQueue.h
+ *
+ * Fixed-capacity object pool and ring queue for the action and event
+ * objects of a ThingDevice, so long running devices neither leak nor
+ * fragment the heap with per-request allocations.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ThingPlatform.h"
+
+/**
+ * Free list over N statically allocated slots for objects of type T.
+ * allocate() returns nullptr once all slots are in use. Safe to use from
+ * several tasks.
+ */
+template <class T, size_t N>
+class ThingPool
+{
+public:
+  ThingPool()
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      slots[i].next = i + 1 < N ? &slots[i + 1] : nullptr;
+    }
+    freeList = &slots[0];
+  }
+
+  void *allocate()
+  {
+    ThingLock lock(mutex);
+    if (freeList == nullptr)
+    {
+      exhausted++;
+      return nullptr;
+    }
+    Slot *slot = freeList;
+    freeList = slot->next;
+    used++;
+    return slot->storage;
+  }
+
+  void release(void *p)
+  {
+    if (p == nullptr)
+    {
+      return;
+    }
+    ThingLock lock(mutex);
+    Slot *slot = (Slot *)p;
+    slot->next = freeList;
+    freeList = slot;
+    used--;
+  }
+
+  size_t inUse() const { return used; }
+
+  size_t capacity() const { return N; }
+
+  // number of allocations that failed because the pool was empty
+  uint32_t exhaustedCount() const { return exhausted; }
+
+private:
+  union Slot
+  {
+    Slot *next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  Slot slots[N];
+  Slot *freeList;
+  size_t used = 0;
+  uint32_t exhausted = 0;
+  ThingMutex mutex;
+};
+
+// what a full queue does with a new entry
+enum ThingOverflowPolicy
+{
+  THING_OVERFLOW_DROP_OLDEST,
+  THING_OVERFLOW_REJECT
+};
+
+struct ThingQueueStats
+{
+  uint32_t queued = 0;
+  uint32_t dropped = 0;
+  uint32_t rejected = 0;
+  size_t depth = 0;
+  size_t highWater = 0;
+};
+
+/**
+ * Bounded FIFO of object pointers. The queue does not own its entries;
+ * whoever pushes decides what happens to an evicted one.
+ */
+template <class T, size_t N>
+class ThingQueue
+{
+public:
+  ThingOverflowPolicy policy;
+
+  ThingQueue(ThingOverflowPolicy policy_) : policy(policy_) {}
+
+  bool full() const { return count == N; }
+
+  size_t size() const { return count; }
+
+  size_t capacity() const { return N; }
+
+  // 0 is the oldest entry
+  T *at(size_t i) const { return items[(head + i) % N]; }
+
+  T *oldest() const { return count > 0 ? items[head] : nullptr; }
+
+  /**
+   * Appends obj. On a full queue, drops and returns the oldest entry under
+   * THING_OVERFLOW_DROP_OLDEST, or returns obj itself (not queued) under
+   * THING_OVERFLOW_REJECT. Returns nullptr if nothing was displaced.
+   */
+  T *push(T *obj)
+  {
+    T *displaced = nullptr;
+    if (full())
+    {
+      if (policy == THING_OVERFLOW_REJECT)
+      {
+        stats.rejected++;
+        return obj;
+      }
+      displaced = popOldest();
+      stats.dropped++;
+    }
+
+    items[(head + count) % N] = obj;
+    count++;
+    stats.queued++;
+    if (count > stats.highWater)
+    {
+      stats.highWater = count;
+    }
+    return displaced;
+  }
+
+  T *popOldest()
+  {
+    if (count == 0)
+    {
+      return nullptr;
+    }
+    T *obj = items[head];
+    head = (head + 1) % N;
+    count--;
+    return obj;
+  }
+
+  // removes a dropped entry, counted like an overflow drop
+  bool evict(T *obj)
+  {
+    if (!remove(obj))
+    {
+      return false;
+    }
+    stats.dropped++;
+    return true;
+  }
+
+  // records an entry refused before it was even created
+  void reject() { stats.rejected++; }
+
+  // removes obj keeping the order of the others, false if not queued
+  bool remove(T *obj)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      if (at(i) == obj)
+      {
+        for (size_t j = i; j + 1 < count; j++)
+        {
+          items[(head + j) % N] = items[(head + j + 1) % N];
+        }
+        count--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  ThingQueueStats getStats() const
+  {
+    ThingQueueStats s = stats;
+    s.depth = count;
+    return s;
+  }
+
+private:
+  T *items[N];
+  size_t head = 0;
+  size_t count = 0;
+  ThingQueueStats stats;
+};
@@ -0,0 +1,151 @@
+/**
+ * ThingReporting.h
+ *
+ * Per-property reporting policy: decides whether a new value is worth
+ * publishing (deadband, rate of change) and when (minimum interval,
+ * heartbeat).
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+struct ThingReportingPolicy
+{
+  // absolute change against the last reported value that triggers a report
+  double deadband = 0;
+  // change relative to |last reported value|, e.g. 0.01 for 1 %
+  double relativeDeadband = 0;
+  // change per second that triggers a report regardless of the deadbands
+  double rateOfChange = 0;
+  // reports are held back (not dropped) until this much time has passed
+  uint32_t minIntervalMs = 0;
+  // heartbeat: report the current value at least this often, 0 disables it
+  uint32_t maxIntervalMs = 0;
+
+  static ThingReportingPolicy absolute(double deadband_, uint32_t minIntervalMs_ = 0,
+                                       uint32_t maxIntervalMs_ = 0)
+  {
+    ThingReportingPolicy p;
+    p.deadband = deadband_;
+    p.minIntervalMs = minIntervalMs_;
+    p.maxIntervalMs = maxIntervalMs_;
+    return p;
+  }
+
+  static ThingReportingPolicy relative(double relativeDeadband_, uint32_t minIntervalMs_ = 0,
+                                       uint32_t maxIntervalMs_ = 0)
+  {
+    ThingReportingPolicy p;
+    p.relativeDeadband = relativeDeadband_;
+    p.minIntervalMs = minIntervalMs_;
+    p.maxIntervalMs = maxIntervalMs_;
+    return p;
+  }
+};
+
+/**
+ * Reporting state of one property. All checks are a handful of compares on
+ * values already in memory, cheap enough to run on every sample.
+ */
+class ThingReporter
+{
+public:
+  ThingReportingPolicy policy;
+
+  /**
+   * Called with every new sample. Returns true if it should be published
+   * now; a significant change inside the minimum interval is remembered and
+   * reported by poll() once the interval has passed.
+   */
+  bool evaluate(double value, uint32_t now)
+  {
+    if (!hasReported)
+    {
+      return true;
+    }
+
+    uint32_t elapsed = now - lastReportMs;
+
+    if (policy.maxIntervalMs > 0 && elapsed >= policy.maxIntervalMs)
+    {
+      return true;
+    }
+
+    pending = isSignificant(value, elapsed);
+    if (!pending)
+    {
+      return false;
+    }
+
+    return elapsed >= policy.minIntervalMs;
+  }
+
+  /**
+   * Called periodically without a new sample. Returns true if a held back
+   * change or a heartbeat is due.
+   */
+  bool poll(uint32_t now) const
+  {
+    if (!hasReported)
+    {
+      return false;
+    }
+
+    uint32_t elapsed = now - lastReportMs;
+
+    if (pending && elapsed >= policy.minIntervalMs)
+    {
+      return true;
+    }
+
+    return policy.maxIntervalMs > 0 && elapsed >= policy.maxIntervalMs;
+  }
+
+  void reported(double value, uint32_t now)
+  {
+    lastValue = value;
+    lastReportMs = now;
+    hasReported = true;
+    pending = false;
+  }
+
+private:
+  double lastValue = 0;
+  uint32_t lastReportMs = 0;
+  bool hasReported = false;
+  bool pending = false;
+
+  bool isSignificant(double value, uint32_t elapsed) const
+  {
+    double delta = fabs(value - lastValue);
+
+    if (delta == 0)
+    {
+      return false;
+    }
+
+    if (policy.deadband <= 0 && policy.relativeDeadband <= 0 && policy.rateOfChange <= 0)
+    {
+      return true;
+    }
+
+    if (policy.deadband > 0 && delta >= policy.deadband)
+    {
+      return true;
+    }
+
+    if (policy.relativeDeadband > 0 && delta >= policy.relativeDeadband * fabs(lastValue))
+    {
+      return true;
+    }
+
+    // delta / (elapsed / 1000) >= rateOfChange, without the division
+    return policy.rateOfChange > 0 && delta * 1000.0 >= policy.rateOfChange * elapsed;
+  }
+};
@@ -0,0 +1,213 @@
+/**
+ * ThingRouter.h
+ *
+ * Topic/path router: patterns such as "things/<id>/properties/+/set" are
+ * compiled once into a trie of '/'-separated segments, and a lookup walks
+ * the incoming topic segment by segment without copying it. '+' matches
+ * exactly one segment and is captured for the handler.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef THING_ROUTE_MAX_CAPTURES
+#define THING_ROUTE_MAX_CAPTURES 4
+#endif
+
+// wildcard segments of a matched topic, pointing into the topic itself
+struct ThingRouteMatch
+{
+  const char *captures[THING_ROUTE_MAX_CAPTURES];
+  size_t lengths[THING_ROUTE_MAX_CAPTURES];
+  size_t count = 0;
+};
+
+typedef void (*ThingRouteHandler)(void *context, const ThingRouteMatch &match, char *payload,
+                                  size_t len);
+
+class ThingRouter
+{
+public:
+  ThingRouter() = default;
+  ThingRouter(const ThingRouter &) = delete;
+  ThingRouter &operator=(const ThingRouter &) = delete;
+
+  ~ThingRouter() { clear(); }
+
+  /**
+   * Registers handler for pattern; a later registration of the same
+   * pattern replaces the earlier one. Returns false if out of memory.
+   */
+  bool add(const char *pattern, ThingRouteHandler handler, void *context)
+  {
+    Node *node = &root;
+    const char *segment = pattern;
+    for (;;)
+    {
+      const char *end = strchr(segment, '/');
+      size_t len = end != nullptr ? (size_t)(end - segment) : strlen(segment);
+
+      node = child(node, segment, len);
+      if (node == nullptr)
+      {
+        return false;
+      }
+      if (end == nullptr)
+      {
+        break;
+      }
+      segment = end + 1;
+    }
+
+    node->handler = handler;
+    node->context = context;
+    return true;
+  }
+
+  /**
+   * Calls the handler of the route matching topic (which need not be NUL
+   * terminated). Exact segments take precedence over '+'. Returns false if
+   * no route matched.
+   */
+  bool dispatch(const char *topic, size_t topicLen, char *payload, size_t len)
+  {
+    ThingRouteMatch match;
+    Node *node = find(&root, topic, topic + topicLen, match);
+    if (node == nullptr)
+    {
+      return false;
+    }
+    node->handler(node->context, match, payload, len);
+    return true;
+  }
+
+  void clear()
+  {
+    freeChildren(&root);
+    root.children = nullptr;
+    root.wildcard = nullptr;
+  }
+
+private:
+  struct Node
+  {
+    char *segment = nullptr;
+    size_t segmentLen = 0;
+    Node *children = nullptr;
+    Node *sibling = nullptr;
+    // the '+' child, kept apart so exact matches are tried first
+    Node *wildcard = nullptr;
+    ThingRouteHandler handler = nullptr;
+    void *context = nullptr;
+  };
+
+  Node root;
+
+  static Node *child(Node *parent, const char *segment, size_t len)
+  {
+    bool isWildcard = len == 1 && segment[0] == '+';
+    if (isWildcard && parent->wildcard != nullptr)
+    {
+      return parent->wildcard;
+    }
+
+    if (!isWildcard)
+    {
+      for (Node *c = parent->children; c != nullptr; c = c->sibling)
+      {
+        if (c->segmentLen == len && memcmp(c->segment, segment, len) == 0)
+        {
+          return c;
+        }
+      }
+    }
+
+    Node *node = new Node();
+    if (node == nullptr)
+    {
+      return nullptr;
+    }
+    if (isWildcard)
+    {
+      parent->wildcard = node;
+      return node;
+    }
+
+    node->segment = (char *)malloc(len);
+    if (node->segment == nullptr)
+    {
+      delete node;
+      return nullptr;
+    }
+    memcpy(node->segment, segment, len);
+    node->segmentLen = len;
+    node->sibling = parent->children;
+    parent->children = node;
+    return node;
+  }
+
+  static Node *find(Node *node, const char *segment, const char *topicEnd, ThingRouteMatch &match)
+  {
+    const char *end = (const char *)memchr(segment, '/', topicEnd - segment);
+    bool last = end == nullptr;
+    if (last)
+    {
+      end = topicEnd;
+    }
+    size_t len = end - segment;
+
+    for (Node *c = node->children; c != nullptr; c = c->sibling)
+    {
+      if (c->segmentLen == len && memcmp(c->segment, segment, len) == 0)
+      {
+        Node *found = last ? (c->handler != nullptr ? c : nullptr)
+                           : find(c, end + 1, topicEnd, match);
+        if (found != nullptr)
+        {
+          return found;
+        }
+        break;
+      }
+    }
+
+    Node *w = node->wildcard;
+    if (w == nullptr || len == 0 || match.count == THING_ROUTE_MAX_CAPTURES)
+    {
+      return nullptr;
+    }
+
+    size_t capture = match.count++;
+    match.captures[capture] = segment;
+    match.lengths[capture] = len;
+    Node *found = last ? (w->handler != nullptr ? w : nullptr) : find(w, end + 1, topicEnd, match);
+    if (found == nullptr)
+    {
+      match.count--;
+    }
+    return found;
+  }
+
+  static void freeChildren(Node *node)
+  {
+    Node *c = node->children;
+    while (c != nullptr)
+    {
+      Node *next = c->sibling;
+      freeChildren(c);
+      free(c->segment);
+      delete c;
+      c = next;
+    }
+    if (node->wildcard != nullptr)
+    {
+      freeChildren(node->wildcard);
+      delete node->wildcard;
+    }
+  }
+};
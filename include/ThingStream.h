@@ -0,0 +1,763 @@
+/**
+ * ThingStream.h
+ *
+ * Small Print sinks, number formatters and a JSON/MessagePack object
+ * writer used to stream Thing Descriptions and values piece by piece
+ * instead of building them in one large JsonDocument.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**
+ * Discards everything and only counts the bytes, used for the size pre-pass.
+ */
+class ThingCountingPrint : public Print
+{
+public:
+  size_t write(uint8_t) override
+  {
+    written++;
+    return 1;
+  }
+
+  size_t write(const uint8_t *, size_t size) override
+  {
+    written += size;
+    return size;
+  }
+
+  size_t count() const { return written; }
+
+private:
+  size_t written = 0;
+};
+
+/**
+ * Writes into a caller owned, fixed size buffer (e.g. an MQTT publish
+ * buffer). Output beyond the capacity is dropped and flagged.
+ */
+class ThingBufferPrint : public Print
+{
+public:
+  ThingBufferPrint(char *buffer_, size_t capacity_)
+      : buffer(buffer_), capacity(capacity_) {}
+
+  size_t write(uint8_t c) override
+  {
+    if (len >= capacity)
+    {
+      overflowed = true;
+      return 0;
+    }
+    buffer[len++] = (char)c;
+    return 1;
+  }
+
+  size_t write(const uint8_t *data, size_t size) override
+  {
+    size_t n = size;
+    if (n > capacity - len)
+    {
+      n = capacity - len;
+      overflowed = true;
+    }
+    memcpy(buffer + len, data, n);
+    len += n;
+    return n;
+  }
+
+  size_t length() const { return len; }
+
+  bool overflow() const { return overflowed; }
+
+  // Drops everything written after position `to`, e.g. a partial entry.
+  void rewind(size_t to)
+  {
+    if (to < len)
+    {
+      len = to;
+    }
+    overflowed = false;
+  }
+
+private:
+  char *buffer;
+  size_t capacity;
+  size_t len = 0;
+  bool overflowed = false;
+};
+
+#define THING_FNV1A_OFFSET 2166136261u
+#define THING_FNV1A_PRIME 16777619u
+
+inline uint32_t thing_fnv1a(uint32_t hash, const uint8_t *data, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ data[i]) * THING_FNV1A_PRIME;
+  }
+  return hash;
+}
+
+/**
+ * Discards everything and keeps a 32 bit FNV-1a hash of it, e.g. for
+ * content based HTTP ETags.
+ */
+class ThingHashPrint : public Print
+{
+public:
+  size_t write(uint8_t c) override
+  {
+    hash = thing_fnv1a(hash, &c, 1);
+    return 1;
+  }
+
+  size_t write(const uint8_t *data, size_t size) override
+  {
+    hash = thing_fnv1a(hash, data, size);
+    return size;
+  }
+
+  uint32_t value() const { return hash; }
+
+private:
+  uint32_t hash = THING_FNV1A_OFFSET;
+};
+
+/**
+ * Appends to an Arduino String; reserve() it first to avoid reallocations.
+ */
+class ThingStringPrint : public Print
+{
+public:
+  ThingStringPrint(String &str_) : str(str_) {}
+
+  size_t write(uint8_t c) override
+  {
+    return str.concat((char)c) ? 1 : 0;
+  }
+
+private:
+  String &str;
+};
+
+#ifndef THING_CHUNK_SIZE
+#define THING_CHUNK_SIZE 512
+#endif
+
+/**
+ * Keeps what is written in a list of THING_CHUNK_SIZE blocks, so a large
+ * document (e.g. a cached TD) never needs one contiguous heap allocation.
+ */
+class ThingChunkBuffer : public Print
+{
+public:
+  ThingChunkBuffer() = default;
+  ThingChunkBuffer(const ThingChunkBuffer &) = delete;
+  ThingChunkBuffer &operator=(const ThingChunkBuffer &) = delete;
+
+  ~ThingChunkBuffer() { clear(); }
+
+  size_t write(uint8_t c) override
+  {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t *data, size_t size) override
+  {
+    size_t written = 0;
+    while (written < size)
+    {
+      if (last == nullptr || last->len == THING_CHUNK_SIZE)
+      {
+        Chunk *chunk = (Chunk *)malloc(sizeof(Chunk));
+        if (chunk == nullptr)
+        {
+          overflowed = true;
+          return written;
+        }
+        chunk->next = nullptr;
+        chunk->len = 0;
+        if (last == nullptr)
+        {
+          first = chunk;
+        }
+        else
+        {
+          last->next = chunk;
+        }
+        last = chunk;
+        chunks++;
+      }
+
+      size_t n = size - written;
+      if (n > THING_CHUNK_SIZE - last->len)
+      {
+        n = THING_CHUNK_SIZE - last->len;
+      }
+      memcpy(last->data + last->len, data + written, n);
+      last->len += n;
+      written += n;
+    }
+    total += written;
+    return written;
+  }
+
+  void clear()
+  {
+    while (first != nullptr)
+    {
+      Chunk *next = first->next;
+      free(first);
+      first = next;
+    }
+    last = nullptr;
+    chunks = 0;
+    total = 0;
+    overflowed = false;
+  }
+
+  size_t length() const { return total; }
+
+  size_t chunkCount() const { return chunks; }
+
+  // true if an allocation failed and the content is incomplete
+  bool overflow() const { return overflowed; }
+
+  // i-th block and its length; walks the list, fine for a handful of blocks
+  const char *chunk(size_t i, size_t *len) const
+  {
+    Chunk *c = first;
+    while (c != nullptr && i-- > 0)
+    {
+      c = c->next;
+    }
+    if (c == nullptr)
+    {
+      *len = 0;
+      return nullptr;
+    }
+    *len = c->len;
+    return c->data;
+  }
+
+  // copies everything to dst, which needs length() bytes
+  void copyTo(char *dst) const
+  {
+    for (Chunk *c = first; c != nullptr; c = c->next)
+    {
+      memcpy(dst, c->data, c->len);
+      dst += c->len;
+    }
+  }
+
+private:
+  struct Chunk
+  {
+    Chunk *next;
+    size_t len;
+    char data[THING_CHUNK_SIZE];
+  };
+
+  Chunk *first = nullptr;
+  Chunk *last = nullptr;
+  size_t chunks = 0;
+  size_t total = 0;
+  bool overflowed = false;
+};
+
+#ifndef THING_HTTP_CHUNK_SIZE
+#define THING_HTTP_CHUNK_SIZE 256
+#endif
+
+/**
+ * Collects what is written in a THING_HTTP_CHUNK_SIZE buffer and passes it
+ * on to out (a socket) one full buffer at a time, framed as HTTP/1.1
+ * "Transfer-Encoding: chunked" chunks unless chunked is false. A response
+ * of any size goes through the same small buffer; end() sends the rest
+ * and the final empty chunk.
+ */
+class ThingChunkedPrint : public Print
+{
+public:
+  ThingChunkedPrint(Print &out_, bool chunked_ = true) : out(out_), chunked(chunked_) {}
+
+  size_t write(uint8_t c) override
+  {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t *data, size_t size) override
+  {
+    for (size_t done = 0; done < size;)
+    {
+      size_t n = size - done < sizeof(buffer) - len ? size - done : sizeof(buffer) - len;
+      memcpy(buffer + len, data + done, n);
+      len += n;
+      done += n;
+      if (len == sizeof(buffer))
+      {
+        sendBuffer();
+      }
+    }
+    return size;
+  }
+
+  void end()
+  {
+    sendBuffer();
+    if (chunked)
+    {
+      out.print("0\r\n\r\n");
+    }
+  }
+
+  // passes on what has been written as one chunk, without ending the body
+  void sendBuffer()
+  {
+    if (len == 0)
+    {
+      return;
+    }
+    if (chunked)
+    {
+      out.print((unsigned long)len, HEX);
+      out.print("\r\n");
+    }
+    out.write(buffer, len);
+    if (chunked)
+    {
+      out.print("\r\n");
+    }
+    len = 0;
+  }
+
+private:
+  Print &out;
+  bool chunked;
+  uint8_t buffer[THING_HTTP_CHUNK_SIZE];
+  size_t len = 0;
+};
+
+inline void thing_write_json_string(Print &out, const char *s)
+{
+  out.write('"');
+  for (; *s != '\0'; s++)
+  {
+    char c = *s;
+    switch (c)
+    {
+    case '"':
+      out.print("\\\"");
+      break;
+    case '\\':
+      out.print("\\\\");
+      break;
+    case '\n':
+      out.print("\\n");
+      break;
+    case '\r':
+      out.print("\\r");
+      break;
+    case '\t':
+      out.print("\\t");
+      break;
+    default:
+      if ((unsigned char)c < 0x20)
+      {
+        out.printf("\\u%04x", c);
+      }
+      else
+      {
+        out.write(c);
+      }
+      break;
+    }
+  }
+  out.write('"');
+}
+
+/**
+ * Wire encodings for value publishes, Thing Descriptions and HTTP bodies.
+ */
+enum ThingEncoding
+{
+  THING_ENCODING_JSON,
+  THING_ENCODING_MSGPACK
+};
+
+inline const char *thing_encoding_content_type(ThingEncoding encoding)
+{
+  return encoding == THING_ENCODING_MSGPACK ? "application/msgpack" : "application/json";
+}
+
+// appended to MQTT topics so JSON subscribers never receive binary payloads
+inline const char *thing_encoding_topic_suffix(ThingEncoding encoding)
+{
+  return encoding == THING_ENCODING_MSGPACK ? "/msgpack" : "";
+}
+
+inline size_t thing_serialize(JsonVariantConst value, Print &out, ThingEncoding encoding)
+{
+  if (encoding == THING_ENCODING_MSGPACK)
+  {
+    return serializeMsgPack(value, out);
+  }
+  return serializeJson(value, out);
+}
+
+inline size_t thing_measure(JsonVariantConst value, ThingEncoding encoding)
+{
+  if (encoding == THING_ENCODING_MSGPACK)
+  {
+    return measureMsgPack(value);
+  }
+  return measureJson(value);
+}
+
+/**
+ * MessagePack primitives for the paths that do not go through a
+ * JsonDocument. Multi-byte values are big endian as the format requires.
+ */
+inline void thing_msgpack_be(Print &out, uint64_t v, uint8_t bytes)
+{
+  uint8_t buf[8];
+  for (uint8_t i = 0; i < bytes; i++)
+  {
+    buf[i] = (uint8_t)(v >> (8 * (bytes - 1 - i)));
+  }
+  out.write(buf, bytes);
+}
+
+inline void thing_msgpack_map(Print &out, uint32_t size)
+{
+  if (size < 16)
+  {
+    out.write((uint8_t)(0x80 | size));
+  }
+  else if (size <= 0xffff)
+  {
+    out.write((uint8_t)0xde);
+    thing_msgpack_be(out, size, 2);
+  }
+  else
+  {
+    out.write((uint8_t)0xdf);
+    thing_msgpack_be(out, size, 4);
+  }
+}
+
+inline void thing_msgpack_array(Print &out, uint32_t size)
+{
+  if (size < 16)
+  {
+    out.write((uint8_t)(0x90 | size));
+  }
+  else if (size <= 0xffff)
+  {
+    out.write((uint8_t)0xdc);
+    thing_msgpack_be(out, size, 2);
+  }
+  else
+  {
+    out.write((uint8_t)0xdd);
+    thing_msgpack_be(out, size, 4);
+  }
+}
+
+inline void thing_msgpack_str(Print &out, const char *s, size_t len)
+{
+  if (len < 32)
+  {
+    out.write((uint8_t)(0xa0 | len));
+  }
+  else if (len <= 0xff)
+  {
+    out.write((uint8_t)0xd9);
+    out.write((uint8_t)len);
+  }
+  else if (len <= 0xffff)
+  {
+    out.write((uint8_t)0xda);
+    thing_msgpack_be(out, len, 2);
+  }
+  else
+  {
+    out.write((uint8_t)0xdb);
+    thing_msgpack_be(out, len, 4);
+  }
+  out.write((const uint8_t *)s, len);
+}
+
+inline void thing_msgpack_str(Print &out, const char *s)
+{
+  thing_msgpack_str(out, s, strlen(s));
+}
+
+inline void thing_msgpack_int(Print &out, int64_t v)
+{
+  if (v >= 0 && v < 128)
+  {
+    out.write((uint8_t)v);
+  }
+  else if (v < 0 && v >= -32)
+  {
+    out.write((uint8_t)(0xe0 | (v + 32)));
+  }
+  else if (v >= INT32_MIN && v <= INT32_MAX)
+  {
+    out.write((uint8_t)0xd2);
+    thing_msgpack_be(out, (uint32_t)(int32_t)v, 4);
+  }
+  else
+  {
+    out.write((uint8_t)0xd3);
+    thing_msgpack_be(out, (uint64_t)v, 8);
+  }
+}
+
+inline void thing_msgpack_double(Print &out, double v)
+{
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  out.write((uint8_t)0xcb);
+  thing_msgpack_be(out, bits, 8);
+}
+
+inline void thing_msgpack_bool(Print &out, bool v)
+{
+  out.write((uint8_t)(v ? 0xc3 : 0xc2));
+}
+
+inline void thing_msgpack_nil(Print &out)
+{
+  out.write((uint8_t)0xc0);
+}
+
+/**
+ * Emits an object (JSON) or map (MessagePack) member by member. Values are
+ * small JsonVariants that the caller builds (and reuses) in a bounded
+ * document, so the complete object never exists in memory at once.
+ * MessagePack needs the member count up front, JSON ignores it.
+ */
+class ThingObjectWriter
+{
+public:
+  ThingObjectWriter(Print &out_, ThingEncoding encoding_ = THING_ENCODING_JSON,
+                    size_t memberCount = 0)
+      : out(out_), encoding(encoding_)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_map(out, memberCount);
+    }
+    else
+    {
+      out.write('{');
+    }
+  }
+
+  // Starts a member; the caller writes the value (e.g. a nested writer).
+  void key(const char *k)
+  {
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_str(out, k);
+      return;
+    }
+
+    if (!first)
+    {
+      out.write(',');
+    }
+    first = false;
+    thing_write_json_string(out, k);
+    out.write(':');
+  }
+
+  void member(const char *k, JsonVariantConst value)
+  {
+    key(k);
+    thing_serialize(value, out, encoding);
+  }
+
+  void member(const char *k, const char *value)
+  {
+    key(k);
+    if (encoding == THING_ENCODING_MSGPACK)
+    {
+      thing_msgpack_str(out, value);
+      return;
+    }
+    thing_write_json_string(out, value);
+  }
+
+  // Copies all members of obj into the object being written.
+  void members(JsonObjectConst obj)
+  {
+    for (JsonPairConst kv : obj)
+    {
+      member(kv.key().c_str(), kv.value());
+    }
+  }
+
+  void end()
+  {
+    if (encoding == THING_ENCODING_JSON)
+    {
+      out.write('}');
+    }
+  }
+
+  Print &stream() { return out; }
+
+  ThingEncoding getEncoding() { return encoding; }
+
+private:
+  Print &out;
+  ThingEncoding encoding;
+  bool first = true;
+};
+
+/**
+ * Number formatting into caller supplied buffers. These never allocate,
+ * unlike printf("%f")/dtoa in newlib, and return the number of characters
+ * written (no terminating NUL).
+ */
+inline size_t thing_format_uint64(char *buf, uint64_t v)
+{
+  char tmp[20];
+  size_t n = 0;
+  do
+  {
+    tmp[n++] = (char)('0' + (v % 10));
+    v /= 10;
+  } while (v != 0);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    buf[i] = tmp[n - 1 - i];
+  }
+  return n;
+}
+
+inline size_t thing_format_int64(char *buf, int64_t v)
+{
+  if (v < 0)
+  {
+    buf[0] = '-';
+    return 1 + thing_format_uint64(buf + 1, (uint64_t)(-(v + 1)) + 1);
+  }
+  return thing_format_uint64(buf, (uint64_t)v);
+}
+
+/**
+ * Formats v the way ArduinoJson 6 serializes a double, so a value reads the
+ * same whether it went through a JsonDocument or not: 9 decimal places
+ * less one per integral digit, trailing zeros dropped, and the exponent
+ * form from 1e7 up and 1e-5 down. NaN and infinity become null. buf needs
+ * room for 24 characters.
+ */
+inline size_t thing_format_double(char *buf, double v)
+{
+  if (isnan(v) || isinf(v))
+  {
+    memcpy(buf, "null", 4);
+    return 4;
+  }
+
+  size_t n = 0;
+  if (v < 0)
+  {
+    buf[n++] = '-';
+    v = -v;
+  }
+
+  // bring v into [1, 1e7), by powers of ten as ArduinoJson does, so the
+  // rounding matches digit for digit
+  static const double positive[] = {1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256};
+  static const double negative[] = {1e-1, 1e-2, 1e-4, 1e-8, 1e-16, 1e-32, 1e-64, 1e-128, 1e-256};
+  static const double negativePlusOne[] = {1e0, 1e-1, 1e-3, 1e-7, 1e-15, 1e-31, 1e-63, 1e-127, 1e-255};
+  int exponent = 0;
+  int bit = 1 << 8;
+  int index = 8;
+  if (v >= 1e7)
+  {
+    for (; index >= 0; index--, bit >>= 1)
+    {
+      if (v >= positive[index])
+      {
+        v *= negative[index];
+        exponent += bit;
+      }
+    }
+  }
+  if (v > 0 && v <= 1e-5)
+  {
+    for (; index >= 0; index--, bit >>= 1)
+    {
+      if (v < negativePlusOne[index])
+      {
+        v *= positive[index];
+        exponent -= bit;
+      }
+    }
+  }
+
+  uint32_t integral = (uint32_t)v;
+  uint32_t scale = 1000000000;
+  int decimals = 9;
+  for (uint32_t i = integral; i >= 10; i /= 10)
+  {
+    scale /= 10;
+    decimals--;
+  }
+
+  double remainder = (v - (double)integral) * (double)scale;
+  uint32_t fraction = (uint32_t)remainder;
+  // round half up
+  fraction += (uint32_t)((remainder - (double)fraction) * 2);
+  if (fraction >= scale)
+  {
+    fraction = 0;
+    integral++;
+    if (exponent != 0 && integral >= 10)
+    {
+      integral = 1;
+      exponent++;
+    }
+  }
+  while (fraction % 10 == 0 && decimals > 0)
+  {
+    fraction /= 10;
+    decimals--;
+  }
+
+  n += thing_format_uint64(buf + n, integral);
+
+  if (decimals > 0)
+  {
+    buf[n++] = '.';
+    for (int i = decimals; i > 0; i--)
+    {
+      buf[n + i - 1] = (char)('0' + fraction % 10);
+      fraction /= 10;
+    }
+    n += decimals;
+  }
+
+  if (exponent != 0)
+  {
+    buf[n++] = 'e';
+    n += thing_format_int64(buf + n, exponent);
+  }
+
+  return n;
+}
@@ -137,6 +137,19 @@ void appendFile(fs::FS &fs, const char *path, const char *message)
   }
 }
 
+// append raw bytes to file, returns the number of bytes written
+size_t appendFileBytes(fs::FS &fs, const char *path, const uint8_t *data, size_t len)
+{
+  File file = fs.open(path, FILE_APPEND);
+  if (!file)
+  {
+    return 0;
+  }
+  size_t written = file.write(data, len);
+  file.close();
+  return written;
+}
+
 // rename file
 void renameFile(fs::FS &fs, const char *path1, const char *path2)
 {
@@ -5,6 +5,7 @@
 #include "filefunctions.h"
 #include <ArduinoJson.h>
 #include "driver/pcnt.h"
+#include "esp_timer.h"
 #include <M5StickCPlus.h>
 #include <WebThingAdapter.h>
 #include <OneWire.h>
@@ -95,8 +96,9 @@ xQueueHandle pcnt_evt_queue; // A queue to handle pulse counter events
  */
 typedef struct
 {
-  int unit;        // the PCNT unit that originated an interrupt
-  uint32_t status; // information on the event type that caused the interrupt
+  int unit;             // the PCNT unit that originated an interrupt
+  uint32_t status;      // information on the event type that caused the interrupt
+  int64_t timestamp_us; // esp_timer time of the interrupt, see thing_timer_to_epoch_ms()
 } pcnt_evt_t;
 
 /* Decode what PCNT's unit originated an interrupt
@@ -111,6 +113,7 @@ static void IRAM_ATTR pcnt_example_intr_handler(void *arg)
   /* Save the PCNT event type that caused an interrupt
      to pass it to the main program */
   pcnt_get_event_status(PCNT_UNIT_0, &evt.status);
+  evt.timestamp_us = esp_timer_get_time();
   xQueueSendFromISR(pcnt_evt_queue, &evt, NULL);
 }
 
@@ -636,10 +639,15 @@ void setup()
   {
     configure_impulse_pin();
     prop_Wasser = new ThingProperty("Water", "Water usage measurement", NUMBER, nullptr, nullptr, nullptr);
+    // one pulse is 0.001, report every pulse but at most once a second, heartbeat every 15 min
+    prop_Wasser->setReportingPolicy(ThingReportingPolicy::absolute(0.0005, 1000, 900000));
+    prop_Wasser->enableHistory();
     multisensor->addProperty(prop_Wasser);
   }
 
   mqttAdapter->addDevice(multisensor);
+  // keep readings taken while the broker is unreachable and send them later
+  mqttAdapter->enableJournal();
   mqttAdapter->begin();
   // start update-functionality
 
@@ -767,7 +775,7 @@ void loop()
           // current_meter_Reading = current_meter_Reading + 1.0;
           ThingPropertyValue temp_new_value;
           temp_new_value.number = Waermeleistung;
-          prop_Gas->setValue(temp_new_value);
+          prop_Gas->setValue(temp_new_value, thing_timer_to_epoch_ms(event.timestamp_us));
           prop_Gas->hasChanged();
         }
       }
@@ -811,13 +819,16 @@ void loop()
 
           ThingPropertyValue temp_new_value;
           temp_new_value.number = current_meter_Reading;
-          prop_Wasser->setValue(temp_new_value);
+          prop_Wasser->setValue(temp_new_value, thing_timer_to_epoch_ms(event.timestamp_us));
           prop_Wasser->hasChanged();
         }
       }
     }
   }
 
+  // publish held back changes and heartbeats
+  mqttAdapter->update();
+
   // delay(1000);
 }
 
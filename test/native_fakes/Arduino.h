@@ -0,0 +1,97 @@
+/**
+ * Arduino.h
+ *
+ * Minimal Arduino core for host builds of the Thing headers: String, Print,
+ * Serial (stdout), millis()/micros()/delay() on the steady clock and
+ * random().
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <thread>
+
+#include "Print.h"
+#include "WString.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+inline std::chrono::steady_clock::time_point thing_fake_boot_time()
+{
+  static const std::chrono::steady_clock::time_point boot = std::chrono::steady_clock::now();
+  return boot;
+}
+
+inline unsigned long millis()
+{
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - thing_fake_boot_time())
+      .count();
+}
+
+inline unsigned long micros()
+{
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - thing_fake_boot_time())
+      .count();
+}
+
+inline void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void yield()
+{
+  std::this_thread::yield();
+}
+
+inline long random(long howsmall, long howbig)
+{
+  return howsmall >= howbig ? howsmall : howsmall + rand() % (howbig - howsmall);
+}
+
+inline long random(long howbig)
+{
+  return random(0, howbig);
+}
+
+// Serial goes to stdout; set quiet to keep benchmark output readable
+class HardwareSerial : public Print
+{
+public:
+  bool quiet = false;
+
+  void begin(unsigned long) {}
+
+  size_t write(uint8_t c) override
+  {
+    if (!quiet)
+    {
+      fputc(c, stdout);
+    }
+    return 1;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    if (!quiet)
+    {
+      fwrite(buffer, 1, size, stdout);
+    }
+    return size;
+  }
+
+  using Print::write;
+};
+
+inline HardwareSerial Serial;
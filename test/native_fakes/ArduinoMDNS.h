@@ -0,0 +1,32 @@
+/**
+ * ArduinoMDNS.h
+ *
+ * Host stand-in for the ArduinoMDNS responder; every call is a no-op.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+#include "EthernetUdp.h"
+#include "IPAddress.h"
+
+typedef enum
+{
+  MDNSServiceTCP,
+  MDNSServiceUDP
+} MDNSServiceProtocol_t;
+
+class MDNS
+{
+public:
+  explicit MDNS(EthernetUDP &) {}
+
+  int begin(const IPAddress &, const char *) { return 1; }
+  int addServiceRecord(const char *, uint16_t, MDNSServiceProtocol_t, const char *) { return 1; }
+  void removeAllServiceRecords() {}
+  void run() {}
+};
@@ -0,0 +1,15 @@
+/**
+ * ESPAsyncWebServer.h
+ *
+ * Host stand-in: the MQTT adapter only relies on what this header pulls in
+ * on ESP32 (the Arduino core and WiFi), not on the web server itself.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+#include "WiFi.h"
@@ -0,0 +1,25 @@
+/**
+ * ESPmDNS.h
+ *
+ * Host stand-in for the ESP32 mDNS responder; every call is a no-op.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+
+class MDNSResponder
+{
+public:
+  bool begin(const char *) { return true; }
+  void end() {}
+  bool update() { return true; }
+  void addService(const char *, const char *, uint16_t) {}
+  void addServiceTxt(const char *, const char *, const char *, const char *) {}
+};
+
+inline MDNSResponder MDNS;
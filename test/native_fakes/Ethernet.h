@@ -0,0 +1,40 @@
+/**
+ * Ethernet.h
+ *
+ * Host stand-in for the Arduino Ethernet object: a fixed MAC and local
+ * address, always linked.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <string.h>
+
+#include "Arduino.h"
+#include "EthernetClient.h"
+#include "EthernetServer.h"
+#include "IPAddress.h"
+
+enum EthernetLinkStatus
+{
+  Unknown,
+  LinkON,
+  LinkOFF
+};
+
+class EthernetClass
+{
+public:
+  IPAddress ip{127, 0, 0, 1};
+
+  int begin(uint8_t *) { return 1; }
+  void begin(uint8_t *, IPAddress address) { ip = address; }
+  int maintain() { return 0; }
+  EthernetLinkStatus linkStatus() const { return LinkON; }
+  IPAddress localIP() const { return ip; }
+};
+
+inline EthernetClass Ethernet;
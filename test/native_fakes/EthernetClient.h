@@ -0,0 +1,97 @@
+/**
+ * EthernetClient.h
+ *
+ * Host stand-in for the Arduino Ethernet client. A client is one end of a
+ * ThingFakeConnection: what the peer sends waits in received until the
+ * sketch reads it, what the sketch writes collects in sent. Connections are
+ * opened with thing_fake_ethernet_connect() in EthernetServer.h.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "Arduino.h"
+
+struct ThingFakeConnection
+{
+  uint16_t port = 0;
+  // peer to sketch, not read yet
+  std::string received;
+  // sketch to peer
+  std::string sent;
+  // the peer has not closed its side
+  bool open = true;
+  // the sketch called stop()
+  bool stopped = false;
+};
+
+class EthernetClient : public Print
+{
+public:
+  EthernetClient() = default;
+  explicit EthernetClient(std::shared_ptr<ThingFakeConnection> _connection)
+      : connection(_connection) {}
+
+  operator bool() const { return connection != nullptr && !connection->stopped; }
+
+  bool operator==(const EthernetClient &other) const { return connection == other.connection; }
+  bool operator!=(const EthernetClient &other) const { return !(*this == other); }
+
+  // like the W5x00 driver, data that arrived before the peer closed can
+  // still be read
+  uint8_t connected()
+  {
+    return *this && (connection->open || !connection->received.empty()) ? 1 : 0;
+  }
+
+  int available() { return *this ? (int)connection->received.size() : 0; }
+
+  int read()
+  {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+
+  int read(uint8_t *buf, size_t size)
+  {
+    if (!*this || connection->received.empty())
+    {
+      return -1;
+    }
+    size_t n = size < connection->received.size() ? size : connection->received.size();
+    memcpy(buf, connection->received.data(), n);
+    connection->received.erase(0, n);
+    return (int)n;
+  }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    if (!*this)
+    {
+      return 0;
+    }
+    connection->sent.append((const char *)buffer, size);
+    return size;
+  }
+
+  using Print::write;
+
+  void stop()
+  {
+    if (connection != nullptr)
+    {
+      connection->stopped = true;
+    }
+  }
+
+private:
+  std::shared_ptr<ThingFakeConnection> connection;
+};
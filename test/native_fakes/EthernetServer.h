@@ -0,0 +1,74 @@
+/**
+ * EthernetServer.h
+ *
+ * Host stand-in for the Arduino Ethernet server. Tests open connections
+ * with thing_fake_ethernet_connect() and talk through the returned
+ * ThingFakeConnection; like the W5x00 driver, available() returns a client
+ * with unread data, whether or not it was returned before.
+ *
+ * Test helpers are prefixed thing_fake_ethernet_.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "EthernetClient.h"
+
+// every connection opened since the last thing_fake_ethernet_reset()
+inline std::vector<std::shared_ptr<ThingFakeConnection>> &thing_fake_ethernet_connections()
+{
+  static std::vector<std::shared_ptr<ThingFakeConnection>> connections;
+  return connections;
+}
+
+inline std::shared_ptr<ThingFakeConnection> thing_fake_ethernet_connect(uint16_t port)
+{
+  std::shared_ptr<ThingFakeConnection> connection = std::make_shared<ThingFakeConnection>();
+  connection->port = port;
+  thing_fake_ethernet_connections().push_back(connection);
+  return connection;
+}
+
+inline void thing_fake_ethernet_reset()
+{
+  thing_fake_ethernet_connections().clear();
+}
+
+class EthernetServer : public Print
+{
+public:
+  explicit EthernetServer(uint16_t _port) : port(_port) {}
+
+  void begin() { listening = true; }
+
+  EthernetClient available()
+  {
+    if (!listening)
+    {
+      return EthernetClient();
+    }
+    for (std::shared_ptr<ThingFakeConnection> &connection : thing_fake_ethernet_connections())
+    {
+      if (connection->port == port && !connection->stopped && !connection->received.empty())
+      {
+        return EthernetClient(connection);
+      }
+    }
+    return EthernetClient();
+  }
+
+  // broadcast to every client is not used by the adapters
+  size_t write(uint8_t) override { return 0; }
+
+  using Print::write;
+
+private:
+  uint16_t port;
+  bool listening = false;
+};
@@ -0,0 +1,24 @@
+/**
+ * EthernetUdp.h
+ *
+ * Host stand-in for the Arduino Ethernet UDP socket; nothing is sent or
+ * received.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+class EthernetUDP
+{
+public:
+  uint8_t begin(uint16_t) { return 1; }
+  uint8_t beginMulticast(IPAddress, uint16_t) { return 1; }
+  void stop() {}
+  int parsePacket() { return 0; }
+};
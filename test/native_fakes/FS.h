@@ -0,0 +1,188 @@
+/**
+ * FS.h
+ *
+ * Host stand-in for the ESP32 file system API, backed by an in-memory map
+ * of paths to contents. Directories are implied by the paths of the files
+ * in them.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+typedef std::map<std::string, std::shared_ptr<std::string>> FileMap;
+
+class File : public Print
+{
+public:
+  File() = default;
+
+  File(std::shared_ptr<std::string> data_, const std::string &path_, bool writable_)
+      : data(data_), path(path_), writable(writable_) {}
+
+  // a directory listing
+  File(const FileMap *files_, const std::string &path_) : files(files_), path(path_) {}
+
+  explicit operator bool() const { return data != nullptr || files != nullptr; }
+
+  bool isDirectory() const { return files != nullptr; }
+  const char *name() const { return path.c_str(); }
+  size_t size() const { return data != nullptr ? data->size() : 0; }
+  size_t position() const { return pos; }
+  int available() { return data != nullptr ? (int)(data->size() - pos) : 0; }
+
+  bool seek(uint32_t offset)
+  {
+    if (data == nullptr || offset > data->size())
+    {
+      return false;
+    }
+    pos = offset;
+    return true;
+  }
+
+  int read()
+  {
+    if (data == nullptr || pos >= data->size())
+    {
+      return -1;
+    }
+    return (uint8_t)(*data)[pos++];
+  }
+
+  size_t read(uint8_t *buffer, size_t len)
+  {
+    if (data == nullptr)
+    {
+      return 0;
+    }
+    size_t n = pos + len <= data->size() ? len : data->size() - pos;
+    memcpy(buffer, data->data() + pos, n);
+    pos += n;
+    return n;
+  }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+
+  size_t write(const uint8_t *buffer, size_t len) override
+  {
+    if (data == nullptr || !writable)
+    {
+      return 0;
+    }
+    data->append((const char *)buffer, len);
+    return len;
+  }
+
+  using Print::write;
+
+  void close()
+  {
+    data = nullptr;
+    files = nullptr;
+  }
+
+  File openNextFile()
+  {
+    if (files == nullptr)
+    {
+      return File();
+    }
+    std::string prefix = path + "/";
+    auto it = files->upper_bound(lastListed.empty() ? prefix : lastListed);
+    if (it == files->end() || it->first.compare(0, prefix.size(), prefix) != 0)
+    {
+      return File();
+    }
+    lastListed = it->first;
+    return File(it->second, it->first, false);
+  }
+
+private:
+  std::shared_ptr<std::string> data;
+  const FileMap *files = nullptr;
+  std::string path;
+  bool writable = false;
+  size_t pos = 0;
+  std::string lastListed;
+};
+
+class FS
+{
+public:
+  File open(const char *path, const char *mode = FILE_READ)
+  {
+    auto it = files.find(path);
+    if (mode[0] == 'r')
+    {
+      if (it != files.end())
+      {
+        return File(it->second, path, false);
+      }
+      return isDirectory(path) ? File(&files, path) : File();
+    }
+
+    if (it == files.end())
+    {
+      it = files.emplace(path, std::make_shared<std::string>()).first;
+    }
+    else if (mode[0] == 'w')
+    {
+      it->second->clear();
+    }
+    return File(it->second, path, true);
+  }
+
+  File open(const String &path, const char *mode = FILE_READ) { return open(path.c_str(), mode); }
+
+  bool exists(const char *path) { return files.count(path) > 0 || isDirectory(path); }
+  bool remove(const char *path) { return files.erase(path) > 0; }
+
+  bool rename(const char *from, const char *to)
+  {
+    auto it = files.find(from);
+    if (it == files.end())
+    {
+      return false;
+    }
+    files[to] = it->second;
+    files.erase(it);
+    return true;
+  }
+
+  // directories only exist while they contain files
+  bool mkdir(const char *) { return true; }
+  bool rmdir(const char *path) { return !isDirectory(path); }
+
+  void clear() { files.clear(); }
+
+private:
+  FileMap files;
+
+  bool isDirectory(const char *path)
+  {
+    std::string prefix = std::string(path) + "/";
+    auto it = files.lower_bound(prefix);
+    return it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+  }
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,32 @@
+/**
+ * IPAddress.h
+ *
+ * Host stand-in for the Arduino IPAddress class, shared by the WiFi and
+ * Ethernet fakes.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "Arduino.h"
+
+class IPAddress
+{
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+
+  String toString() const
+  {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+    return String(buf);
+  }
+
+private:
+  uint8_t octets[4];
+};
@@ -0,0 +1,84 @@
+/**
+ * Print.h
+ *
+ * Host stand-in for the Arduino Print base class.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+
+class Print
+{
+public:
+  virtual ~Print() = default;
+
+  virtual size_t write(uint8_t c) = 0;
+
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size-- > 0)
+    {
+      n += write(*buffer++);
+    }
+    return n;
+  }
+
+  size_t write(const char *s) { return s != nullptr ? write((const uint8_t *)s, strlen(s)) : 0; }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+  virtual void flush() {}
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(const String &s) { return write(s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print(String(v, base)); }
+  size_t print(int v, int base = DEC) { return print(String(v, base)); }
+  size_t print(unsigned int v, int base = DEC) { return print(String(v, base)); }
+  size_t print(long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(unsigned long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(long long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(unsigned long long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(double v, int decimals = 2) { return print(String(v, decimals)); }
+
+  size_t println() { return write("\r\n"); }
+
+  template <typename T>
+  size_t println(const T &v)
+  {
+    return print(v) + println();
+  }
+
+  template <typename T>
+  size_t println(const T &v, int format)
+  {
+    return print(v, format) + println();
+  }
+
+  __attribute__((format(printf, 2, 3))) size_t printf(const char *format, ...)
+  {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0)
+    {
+      return 0;
+    }
+    return write(buffer, (size_t)len < sizeof(buffer) ? (size_t)len : sizeof(buffer) - 1);
+  }
+};
@@ -0,0 +1,27 @@
+/**
+ * SD.h
+ *
+ * Host stand-in for the SD card file system, in memory, see FS.h.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "FS.h"
+
+namespace fs
+{
+
+class SDFS : public FS
+{
+public:
+  bool begin() { return true; }
+  void end() {}
+};
+
+} // namespace fs
+
+inline fs::SDFS SD;
@@ -0,0 +1,35 @@
+/**
+ * SPIFFS.h
+ *
+ * Host stand-in for the SPIFFS file system, in memory, see FS.h.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "FS.h"
+
+namespace fs
+{
+
+class SPIFFSFS : public FS
+{
+public:
+  bool begin(bool formatOnFail = false, const char * = "/spiffs", uint8_t = 10,
+             const char * = nullptr)
+  {
+    (void)formatOnFail;
+    return true;
+  }
+
+  void end() {}
+  size_t totalBytes() { return 1024 * 1024; }
+  size_t usedBytes() { return 0; }
+};
+
+} // namespace fs
+
+inline fs::SPIFFSFS SPIFFS;
@@ -0,0 +1,260 @@
+/**
+ * WString.h
+ *
+ * Host stand-in for the Arduino String class, covering what the Thing
+ * headers and ArduinoJson use. Backed by std::string.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <string>
+
+class StringSumHelper;
+
+class String
+{
+public:
+  String() = default;
+  String(const char *s) : str(s != nullptr ? s : "") {}
+  String(const String &) = default;
+  String(String &&) = default;
+  explicit String(char c) : str(1, c) {}
+  explicit String(unsigned char v, unsigned char base = 10) { format((unsigned long long)v, base); }
+  explicit String(int v, unsigned char base = 10) { format((long long)v, base); }
+  explicit String(unsigned int v, unsigned char base = 10) { format((unsigned long long)v, base); }
+  explicit String(long v, unsigned char base = 10) { format((long long)v, base); }
+  explicit String(unsigned long v, unsigned char base = 10) { format((unsigned long long)v, base); }
+  explicit String(long long v, unsigned char base = 10) { format(v, base); }
+  explicit String(unsigned long long v, unsigned char base = 10) { format(v, base); }
+  explicit String(float v, unsigned char decimals = 2) { format((double)v, decimals); }
+  explicit String(double v, unsigned char decimals = 2) { format(v, decimals); }
+
+  String &operator=(const String &) = default;
+  String &operator=(String &&) = default;
+  String &operator=(const char *s)
+  {
+    str = s != nullptr ? s : "";
+    return *this;
+  }
+
+  bool reserve(unsigned int size)
+  {
+    str.reserve(size);
+    return true;
+  }
+
+  unsigned int length() const { return (unsigned int)str.size(); }
+  bool isEmpty() const { return str.empty(); }
+  const char *c_str() const { return str.c_str(); }
+
+  bool concat(const String &s) { return append(s.str.data(), s.str.size()); }
+  bool concat(const char *s) { return s != nullptr && append(s, strlen(s)); }
+  bool concat(const char *s, unsigned int len) { return s != nullptr && append(s, len); }
+  bool concat(char c) { return append(&c, 1); }
+  bool concat(unsigned char v) { return concat(String(v)); }
+  bool concat(int v) { return concat(String(v)); }
+  bool concat(unsigned int v) { return concat(String(v)); }
+  bool concat(long v) { return concat(String(v)); }
+  bool concat(unsigned long v) { return concat(String(v)); }
+  bool concat(long long v) { return concat(String(v)); }
+  bool concat(unsigned long long v) { return concat(String(v)); }
+  bool concat(float v) { return concat(String(v)); }
+  bool concat(double v) { return concat(String(v)); }
+
+  template <typename T>
+  String &operator+=(const T &v)
+  {
+    concat(v);
+    return *this;
+  }
+
+  int compareTo(const String &s) const { return str.compare(s.str); }
+  bool equals(const String &s) const { return str == s.str; }
+  bool equals(const char *s) const { return str == (s != nullptr ? s : ""); }
+  bool equalsIgnoreCase(const String &s) const { return strcasecmp(c_str(), s.c_str()) == 0; }
+  bool operator==(const String &s) const { return equals(s); }
+  bool operator==(const char *s) const { return equals(s); }
+  bool operator!=(const String &s) const { return !equals(s); }
+  bool operator!=(const char *s) const { return !equals(s); }
+  bool operator<(const String &s) const { return compareTo(s) < 0; }
+  bool operator>(const String &s) const { return compareTo(s) > 0; }
+  bool startsWith(const String &prefix) const { return str.compare(0, prefix.str.size(), prefix.str) == 0; }
+  bool endsWith(const String &suffix) const
+  {
+    return str.size() >= suffix.str.size() &&
+           str.compare(str.size() - suffix.str.size(), suffix.str.size(), suffix.str) == 0;
+  }
+
+  char charAt(unsigned int index) const { return index < str.size() ? str[index] : 0; }
+  void setCharAt(unsigned int index, char c)
+  {
+    if (index < str.size())
+    {
+      str[index] = c;
+    }
+  }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char &operator[](unsigned int index) { return str[index]; }
+
+  int indexOf(char c, unsigned int from = 0) const { return position(str.find(c, from)); }
+  int indexOf(const String &s, unsigned int from = 0) const { return position(str.find(s.str, from)); }
+  int lastIndexOf(char c) const { return position(str.rfind(c)); }
+  int lastIndexOf(const String &s) const { return position(str.rfind(s.str)); }
+
+  String substring(unsigned int from) const { return substring(from, length()); }
+  String substring(unsigned int from, unsigned int to) const
+  {
+    if (from > to)
+    {
+      unsigned int t = from;
+      from = to;
+      to = t;
+    }
+    if (from >= str.size())
+    {
+      return String();
+    }
+    return String(str.substr(from, to - from));
+  }
+
+  void replace(const String &find, const String &replacement)
+  {
+    if (find.str.empty())
+    {
+      return;
+    }
+    for (size_t at = str.find(find.str); at != std::string::npos;
+         at = str.find(find.str, at + replacement.str.size()))
+    {
+      str.replace(at, find.str.size(), replacement.str);
+    }
+  }
+  void remove(unsigned int index) { remove(index, (unsigned int)-1); }
+  void remove(unsigned int index, unsigned int count)
+  {
+    if (index < str.size())
+    {
+      str.erase(index, count);
+    }
+  }
+  void toLowerCase()
+  {
+    for (char &c : str)
+    {
+      c = (char)tolower((unsigned char)c);
+    }
+  }
+  void toUpperCase()
+  {
+    for (char &c : str)
+    {
+      c = (char)toupper((unsigned char)c);
+    }
+  }
+  void trim()
+  {
+    size_t begin = str.find_first_not_of(" \t\r\n");
+    size_t end = str.find_last_not_of(" \t\r\n");
+    str = begin == std::string::npos ? std::string() : str.substr(begin, end - begin + 1);
+  }
+
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return (float)atof(c_str()); }
+  double toDouble() const { return atof(c_str()); }
+
+private:
+  std::string str;
+
+  explicit String(const std::string &s) : str(s) {}
+
+  bool append(const char *s, size_t len)
+  {
+    str.append(s, len);
+    return true;
+  }
+
+  static int position(size_t at) { return at == std::string::npos ? -1 : (int)at; }
+
+  void format(long long v, unsigned char base)
+  {
+    if (v < 0 && base == 10)
+    {
+      str = "-";
+      appendUnsigned(0 - (unsigned long long)v, base);
+      return;
+    }
+    appendUnsigned((unsigned long long)v, base);
+  }
+
+  void format(unsigned long long v, unsigned char base) { appendUnsigned(v, base); }
+
+  void appendUnsigned(unsigned long long v, unsigned char base)
+  {
+    char digits[65];
+    size_t i = sizeof(digits);
+    do
+    {
+      unsigned d = (unsigned)(v % base);
+      digits[--i] = (char)(d < 10 ? '0' + d : 'a' + d - 10);
+      v /= base;
+    } while (v > 0);
+    str.append(digits + i, sizeof(digits) - i);
+  }
+
+  void format(double v, unsigned char decimals)
+  {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+    str = buf;
+  }
+};
+
+class StringSumHelper : public String
+{
+public:
+  StringSumHelper(const String &s) : String(s) {}
+  StringSumHelper(const char *p) : String(p) {}
+  StringSumHelper(char c) : String(c) {}
+  StringSumHelper(unsigned char v) : String(v) {}
+  StringSumHelper(int v) : String(v) {}
+  StringSumHelper(unsigned int v) : String(v) {}
+  StringSumHelper(long v) : String(v) {}
+  StringSumHelper(unsigned long v) : String(v) {}
+  StringSumHelper(long long v) : String(v) {}
+  StringSumHelper(unsigned long long v) : String(v) {}
+  StringSumHelper(float v) : String(v) {}
+  StringSumHelper(double v) : String(v) {}
+};
+
+#define THING_FAKE_STRING_SUM(type)                                      \
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, type rhs) \
+  {                                                                       \
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);              \
+    a.concat(rhs);                                                        \
+    return a;                                                             \
+  }
+
+THING_FAKE_STRING_SUM(const String &)
+THING_FAKE_STRING_SUM(const char *)
+THING_FAKE_STRING_SUM(char)
+THING_FAKE_STRING_SUM(unsigned char)
+THING_FAKE_STRING_SUM(int)
+THING_FAKE_STRING_SUM(unsigned int)
+THING_FAKE_STRING_SUM(long)
+THING_FAKE_STRING_SUM(unsigned long)
+THING_FAKE_STRING_SUM(long long)
+THING_FAKE_STRING_SUM(unsigned long long)
+THING_FAKE_STRING_SUM(float)
+THING_FAKE_STRING_SUM(double)
+
+#undef THING_FAKE_STRING_SUM
@@ -0,0 +1,34 @@
+/**
+ * WiFi.h
+ *
+ * Host stand-in for the ESP32 WiFi object: a fixed MAC and local address.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <string.h>
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+class WiFiClass
+{
+public:
+  uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01};
+  IPAddress ip{127, 0, 0, 1};
+
+  uint8_t *macAddress(uint8_t *out)
+  {
+    memcpy(out, mac, sizeof(mac));
+    return out;
+  }
+
+  IPAddress localIP() const { return ip; }
+  bool isConnected() const { return true; }
+};
+
+inline WiFiClass WiFi;
@@ -0,0 +1,11 @@
+/**
+ * cJSON.h
+ *
+ * Host stand-in; the adapters include cJSON but do not use it.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
@@ -0,0 +1,15 @@
+/**
+ * freertos/task.h
+ *
+ * Host stand-in, see freertos/FreeRTOS.h.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
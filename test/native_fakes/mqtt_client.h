@@ -0,0 +1,376 @@
+/**
+ * mqtt_client.h
+ *
+ * Host stand-in for the esp-mqtt client API (ESP-IDF 4.x) that doubles as
+ * an in-process broker: a publish is "delivered" synchronously, counted,
+ * and handed to an optional hook, so tests and benchmarks can observe what
+ * the adapter sends without a network. CONNECTED, DISCONNECTED and DATA
+ * are dispatched on the calling thread. PUBLISHED is queued and dispatched
+ * by thing_fake_mqtt_loop(), standing in for the MQTT task, since the
+ * caller of a publish may hold a lock its handler needs.
+ *
+ * Test helpers are prefixed thing_fake_mqtt_.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+// PUBLISHED events waiting for thing_fake_mqtt_loop(); more are lost
+#ifndef THING_FAKE_MQTT_PENDING_ACKS
+#define THING_FAKE_MQTT_PENDING_ACKS 256
+#endif
+
+typedef enum
+{
+  MQTT_EVENT_ANY = -1,
+  MQTT_EVENT_ERROR = 0,
+  MQTT_EVENT_CONNECTED,
+  MQTT_EVENT_DISCONNECTED,
+  MQTT_EVENT_SUBSCRIBED,
+  MQTT_EVENT_UNSUBSCRIBED,
+  MQTT_EVENT_PUBLISHED,
+  MQTT_EVENT_DATA,
+  MQTT_EVENT_BEFORE_CONNECT,
+  MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef struct
+{
+  esp_mqtt_event_id_t event_id;
+  esp_mqtt_client_handle_t client;
+  void *user_context;
+  char *data;
+  int data_len;
+  int total_data_len;
+  int current_data_offset;
+  char *topic;
+  int topic_len;
+  int msg_id;
+  int session_present;
+  bool retain;
+  int qos;
+  bool dup;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct
+{
+  const char *uri;
+  const char *host;
+  uint32_t port;
+  const char *client_id;
+  const char *username;
+  const char *password;
+  const char *lwt_topic;
+  const char *lwt_msg;
+  int lwt_qos;
+  int lwt_retain;
+  int lwt_msg_len;
+  int disable_clean_session;
+  int keepalive;
+  bool disable_auto_reconnect;
+  void *user_context;
+  int task_prio;
+  int task_stack;
+  int buffer_size;
+  int out_buffer_size;
+  int reconnect_timeout_ms;
+  int network_timeout_ms;
+} esp_mqtt_client_config_t;
+
+// called for every message the fake broker accepts
+typedef void (*thing_fake_mqtt_publish_hook)(void *context, const char *topic, const char *data,
+                                             int len, int qos, int retain);
+
+struct thing_fake_mqtt_stats
+{
+  uint32_t published = 0;
+  uint32_t enqueued = 0;
+  // refused because the client was not connected
+  uint32_t refused = 0;
+  uint64_t topicBytes = 0;
+  uint64_t payloadBytes = 0;
+  uint32_t subscriptions = 0;
+  uint32_t connects = 0;
+  uint32_t reconnectRequests = 0;
+  uint32_t lostAcks = 0;
+};
+
+struct esp_mqtt_client
+{
+  std::string uri;
+  std::string clientId;
+  std::string username;
+  std::string password;
+  bool cleanSession = true;
+  int keepalive = 120;
+  bool autoReconnect = true;
+
+  esp_event_handler_t handler = nullptr;
+  void *handlerArg = nullptr;
+  thing_fake_mqtt_publish_hook hook = nullptr;
+  void *hookContext = nullptr;
+
+  std::mutex mutex;
+  bool started = false;
+  bool connected = false;
+  // a broker keeps the session of a client that connected without clean session
+  bool hasSession = false;
+  int nextMsgId = 1;
+  int pendingAcks[THING_FAKE_MQTT_PENDING_ACKS];
+  size_t pendingAckCount = 0;
+  thing_fake_mqtt_stats stats;
+  std::vector<std::string> subscriptions;
+};
+
+inline void thing_fake_mqtt_dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t &event)
+{
+  event.client = client;
+  if (client->handler != nullptr)
+  {
+    client->handler(client->handlerArg, "MQTT_EVENTS", event.event_id, &event);
+  }
+}
+
+inline void thing_fake_mqtt_connect(esp_mqtt_client_handle_t client)
+{
+  esp_mqtt_event_t event = {};
+  {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (client->connected)
+    {
+      return;
+    }
+    client->connected = true;
+    client->stats.connects++;
+    event.session_present = !client->cleanSession && client->hasSession;
+    client->hasSession = !client->cleanSession;
+  }
+  event.event_id = MQTT_EVENT_CONNECTED;
+  thing_fake_mqtt_dispatch(client, event);
+}
+
+// dispatches the queued PUBLISHED events; returns how many
+inline size_t thing_fake_mqtt_loop(esp_mqtt_client_handle_t client)
+{
+  int acks[THING_FAKE_MQTT_PENDING_ACKS];
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    count = client->pendingAckCount;
+    memcpy(acks, client->pendingAcks, count * sizeof(int));
+    client->pendingAckCount = 0;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_PUBLISHED;
+    event.msg_id = acks[i];
+    thing_fake_mqtt_dispatch(client, event);
+  }
+  return count;
+}
+
+// the broker went away; the client waits for esp_mqtt_client_reconnect()
+inline void thing_fake_mqtt_drop(esp_mqtt_client_handle_t client)
+{
+  {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (!client->connected)
+    {
+      return;
+    }
+    client->connected = false;
+  }
+  esp_mqtt_event_t event = {};
+  event.event_id = MQTT_EVENT_DISCONNECTED;
+  thing_fake_mqtt_dispatch(client, event);
+}
+
+// a message from the broker on a subscribed topic
+inline void thing_fake_mqtt_deliver(esp_mqtt_client_handle_t client, const char *topic,
+                                    const char *data, int len)
+{
+  std::string topicCopy(topic);
+  std::string dataCopy(data, len);
+  esp_mqtt_event_t event = {};
+  event.event_id = MQTT_EVENT_DATA;
+  event.topic = &topicCopy[0];
+  event.topic_len = (int)topicCopy.size();
+  event.data = &dataCopy[0];
+  event.data_len = len;
+  event.total_data_len = len;
+  thing_fake_mqtt_dispatch(client, event);
+}
+
+inline void thing_fake_mqtt_set_hook(esp_mqtt_client_handle_t client,
+                                     thing_fake_mqtt_publish_hook hook, void *context)
+{
+  std::lock_guard<std::mutex> lock(client->mutex);
+  client->hook = hook;
+  client->hookContext = context;
+}
+
+inline thing_fake_mqtt_stats thing_fake_mqtt_get_stats(esp_mqtt_client_handle_t client)
+{
+  std::lock_guard<std::mutex> lock(client->mutex);
+  return client->stats;
+}
+
+inline void thing_fake_mqtt_reset_stats(esp_mqtt_client_handle_t client)
+{
+  std::lock_guard<std::mutex> lock(client->mutex);
+  client->stats = thing_fake_mqtt_stats();
+}
+
+inline esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+  esp_mqtt_client_handle_t client = new esp_mqtt_client();
+  client->uri = config->uri != nullptr ? config->uri : "";
+  client->clientId = config->client_id != nullptr ? config->client_id : "";
+  client->username = config->username != nullptr ? config->username : "";
+  client->password = config->password != nullptr ? config->password : "";
+  client->cleanSession = !config->disable_clean_session;
+  client->keepalive = config->keepalive > 0 ? config->keepalive : 120;
+  client->autoReconnect = !config->disable_auto_reconnect;
+  return client;
+}
+
+inline esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client,
+                                                esp_mqtt_event_id_t event,
+                                                esp_event_handler_t handler, void *arg)
+{
+  (void)event;
+  client->handler = handler;
+  client->handlerArg = arg;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+  client->started = true;
+  thing_fake_mqtt_connect(client);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client)
+{
+  {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    client->stats.reconnectRequests++;
+    if (!client->started || client->connected)
+    {
+      return ESP_FAIL;
+    }
+  }
+  thing_fake_mqtt_connect(client);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+  thing_fake_mqtt_drop(client);
+  client->started = false;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+  delete client;
+  return ESP_OK;
+}
+
+inline int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+  (void)qos;
+  std::lock_guard<std::mutex> lock(client->mutex);
+  client->subscriptions.push_back(topic);
+  client->stats.subscriptions++;
+  return client->nextMsgId++;
+}
+
+inline int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+  std::lock_guard<std::mutex> lock(client->mutex);
+  for (size_t i = 0; i < client->subscriptions.size(); i++)
+  {
+    if (client->subscriptions[i] == topic)
+    {
+      client->subscriptions.erase(client->subscriptions.begin() + i);
+      break;
+    }
+  }
+  return client->nextMsgId++;
+}
+
+// len 0 means data is NUL terminated, as with the real client
+inline int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic,
+                                   const char *data, int len, int qos, int retain)
+{
+  if (len == 0 && data != nullptr)
+  {
+    len = (int)strlen(data);
+  }
+
+  thing_fake_mqtt_publish_hook hook;
+  void *hookContext;
+  int msgId;
+  {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (!client->connected)
+    {
+      client->stats.refused++;
+      return -1;
+    }
+    msgId = qos > 0 ? client->nextMsgId++ : 0;
+    if (qos > 0 && client->pendingAckCount < THING_FAKE_MQTT_PENDING_ACKS)
+    {
+      client->pendingAcks[client->pendingAckCount++] = msgId;
+    }
+    else if (qos > 0)
+    {
+      client->stats.lostAcks++;
+    }
+    client->stats.published++;
+    client->stats.topicBytes += strlen(topic);
+    client->stats.payloadBytes += len;
+    hook = client->hook;
+    hookContext = client->hookContext;
+  }
+
+  if (hook != nullptr)
+  {
+    hook(hookContext, topic, data, len, qos, retain);
+  }
+  return msgId;
+}
+
+// the fake has no outbox of its own: delivered now if connected, else lost
+inline int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic,
+                                   const char *data, int len, int qos, int retain, bool store)
+{
+  (void)store;
+  {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    client->stats.enqueued++;
+  }
+  int msgId = esp_mqtt_client_publish(client, topic, data, len, qos, retain);
+  return msgId < 0 && qos > 0 ? 0 : msgId;
+}
@@ -0,0 +1,401 @@
+/**
+ * test_main.cpp
+ *
+ * Routing of the Ethernet adapter: a device registered with addDevice(),
+ * before or after begin(), answers GET /things/<id> with 200, through the
+ * Ethernet stand-in in test/native_fakes. Also persistent connections:
+ * pipelined requests, HTTP/1.0 keep-alive and the request limit. And
+ * responses held back in their slot: long polls of properties and events,
+ * and text/event-stream.
+ *
+ *   pio test -e native -f test_http_adapter -v
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// the CoAP form of ThingAction reads WiFi.localIP()
+#include <WiFi.h>
+
+#include <EthernetWebThingAdapter.h>
+#include <unity.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// updates after which a response to a single request is complete
+#ifndef TEST_HTTP_UPDATES
+#define TEST_HTTP_UPDATES 16
+#endif
+
+static const uint16_t port = 80;
+
+static const char *lampTypes[] = {"Light", nullptr};
+static const char *sensorTypes[] = {"Sensor", nullptr};
+
+static WebThingAdapter *adapter = nullptr;
+static ThingDevice *lamp = nullptr;
+static ThingDevice *sensor = nullptr;
+static ThingProperty *on = nullptr;
+static ThingProperty *level = nullptr;
+static ThingEvent *overheated = nullptr;
+
+// runs the adapter and returns what it sent on connection meanwhile
+static std::string pump(std::shared_ptr<ThingFakeConnection> connection)
+{
+  size_t before = connection->sent.size();
+  for (int i = 0; i < TEST_HTTP_UPDATES; i++)
+  {
+    adapter->update();
+  }
+  return connection->sent.substr(before);
+}
+
+// sends data on connection and returns what came back
+static std::string roundTrip(std::shared_ptr<ThingFakeConnection> connection, const std::string &data)
+{
+  size_t before = connection->sent.size();
+  connection->received += data;
+  for (int i = 0; i < TEST_HTTP_UPDATES; i++)
+  {
+    adapter->update();
+  }
+  return connection->sent.substr(before);
+}
+
+static std::string request(const char *method, const char *path, const char *version,
+                           const char *headers = "")
+{
+  return std::string(method) + " " + path + " " + version + "\r\nHost: localhost\r\n" + headers +
+         "\r\n";
+}
+
+// sends request on a new connection and returns what came back
+static std::string get(const char *path)
+{
+  return roundTrip(thing_fake_ethernet_connect(port), request("GET", path, "HTTP/1.1"));
+}
+
+static bool startsWith(const std::string &s, const char *prefix)
+{
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static size_t count(const std::string &s, const char *needle)
+{
+  size_t n = 0;
+  for (size_t i = s.find(needle); i != std::string::npos; i = s.find(needle, i + 1))
+  {
+    n++;
+  }
+  return n;
+}
+
+void setUp()
+{
+  Serial.quiet = true;
+  thing_fake_ethernet_reset();
+
+  adapter = new WebThingAdapter("test", 0x0100007f, port);
+  lamp = new ThingDevice("lamp", "Lamp", lampTypes);
+  on = new ThingProperty("on", "Whether the lamp is lit", BOOLEAN, "OnOffProperty", nullptr);
+  lamp->addProperty(on);
+  overheated = new ThingEvent("overheated", "The lamp is too hot", NUMBER, "OverheatedEvent", nullptr);
+  lamp->addEvent(overheated);
+  sensor = new ThingDevice("sensor", "Sensor", sensorTypes);
+  level = new ThingProperty("level", "Level", NUMBER, "LevelProperty", nullptr);
+  sensor->addProperty(level);
+}
+
+void tearDown()
+{
+  delete adapter;
+  adapter = nullptr;
+  delete lamp;
+  delete sensor;
+  delete on;
+  delete level;
+  delete overheated;
+}
+
+void test_device_added_before_begin()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::string response = get("/things/lamp");
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+}
+
+void test_device_added_after_begin()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+  adapter->addDevice(sensor);
+
+  std::string response = get("/things/sensor");
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+  response = get("/things/lamp");
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+}
+
+void test_unknown_device()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::string response = get("/things/sensor");
+  TEST_ASSERT_FALSE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+}
+
+void test_keep_alive_off()
+{
+  adapter->addDevice(lamp);
+  adapter->setKeepAlive(0);
+  adapter->begin();
+
+  std::string response = get("/things/lamp");
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+  TEST_ASSERT_TRUE(response.find("Connection: close\r\n") != std::string::npos);
+}
+
+void test_pipelined_requests()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response = roundTrip(connection, request("GET", "/things/lamp/properties/on", "HTTP/1.1") +
+                                                  request("GET", "/things/lamp", "HTTP/1.1") +
+                                                  request("GET", "/things/lamp/properties/on", "HTTP/1.1"));
+  TEST_ASSERT_EQUAL_MESSAGE(3, count(response, "HTTP/1.1 200"), response.c_str());
+  // answered in order
+  size_t td = response.find("\"title\":\"Lamp\"");
+  TEST_ASSERT_TRUE(response.find("{\"time\"") < td);
+  TEST_ASSERT_TRUE(response.rfind("{\"time\"") > td);
+  TEST_ASSERT_FALSE(connection->stopped);
+}
+
+void test_error_closes_pipeline()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response = roundTrip(connection, request("GET", "/things/sensor", "HTTP/1.1") +
+                                                   request("GET", "/things/lamp", "HTTP/1.1"));
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 400"), response.c_str());
+  TEST_ASSERT_EQUAL(0, count(response, "HTTP/1.1 200"));
+  TEST_ASSERT_TRUE(connection->stopped);
+}
+
+void test_http10_keep_alive()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string keepAlive = request("GET", "/things/lamp/properties/on", "HTTP/1.0", "Connection: keep-alive\r\n");
+  std::string response = roundTrip(connection, keepAlive);
+  TEST_ASSERT_TRUE_MESSAGE(response.find(" 200 ") != std::string::npos, response.c_str());
+  TEST_ASSERT_TRUE(response.find("Connection: keep-alive\r\n") != std::string::npos);
+  TEST_ASSERT_FALSE(connection->stopped);
+
+  response = roundTrip(connection, request("GET", "/things/lamp/properties/on", "HTTP/1.0"));
+  TEST_ASSERT_TRUE_MESSAGE(response.find(" 200 ") != std::string::npos, response.c_str());
+  TEST_ASSERT_TRUE(response.find("Connection: close\r\n") != std::string::npos);
+  TEST_ASSERT_TRUE(connection->stopped);
+}
+
+void test_connection_close()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response =
+      roundTrip(connection, request("GET", "/things/lamp/properties/on", "HTTP/1.1", "Connection: close\r\n"));
+  TEST_ASSERT_TRUE(response.find("Connection: close\r\n") != std::string::npos);
+  TEST_ASSERT_TRUE(connection->stopped);
+}
+
+void test_keep_alive_max_requests()
+{
+  adapter->addDevice(lamp);
+  adapter->setKeepAlive(60000, 2);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response = roundTrip(connection, request("GET", "/things/lamp/properties/on", "HTTP/1.1"));
+  TEST_ASSERT_TRUE(response.find("Connection: keep-alive\r\n") != std::string::npos);
+  response = roundTrip(connection, request("GET", "/things/lamp/properties/on", "HTTP/1.1"));
+  TEST_ASSERT_TRUE(response.find("Connection: close\r\n") != std::string::npos);
+  TEST_ASSERT_TRUE(connection->stopped);
+}
+
+static void switchOn()
+{
+  ThingDataValue value;
+  value.boolean = true;
+  on->setValue(value);
+}
+
+void test_property_long_poll()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response =
+      roundTrip(connection, request("GET", "/things/lamp/properties/on?wait=10", "HTTP/1.1"));
+  TEST_ASSERT_TRUE_MESSAGE(response.empty(), response.c_str());
+  TEST_ASSERT_EQUAL(1, adapter->getHttpStats().parked);
+
+  switchOn();
+  response = pump(connection);
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+  TEST_ASSERT_TRUE(response.find("\"on\":true") != std::string::npos);
+  TEST_ASSERT_EQUAL(0, adapter->getHttpStats().parked);
+  TEST_ASSERT_FALSE(connection->stopped);
+}
+
+void test_property_long_poll_timeout()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response =
+      roundTrip(connection, request("GET", "/things/lamp/properties/on?wait=1", "HTTP/1.1"));
+  TEST_ASSERT_TRUE_MESSAGE(response.empty(), response.c_str());
+
+  delay(1100);
+  response = pump(connection);
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+  TEST_ASSERT_TRUE(response.find("\"on\":false") != std::string::npos);
+}
+
+void test_property_long_poll_stale_etag()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  // the client has an older value than the current one, so no wait
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response = roundTrip(connection, request("GET", "/things/lamp/properties/on?wait=10", "HTTP/1.1",
+                                                       "If-None-Match: \"0\"\r\n"));
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+  TEST_ASSERT_EQUAL(0, adapter->getHttpStats().parked);
+}
+
+void test_event_long_poll()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  ThingDataValue value;
+  value.number = 70;
+  // queued before the poll, so not part of its answer
+  lamp->queueEvent("overheated", NUMBER, value);
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response =
+      roundTrip(connection, request("GET", "/things/lamp/events/overheated?wait=10", "HTTP/1.1"));
+  TEST_ASSERT_TRUE_MESSAGE(response.empty(), response.c_str());
+
+  value.number = 85;
+  lamp->queueEvent("overheated", NUMBER, value);
+  response = pump(connection);
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+  TEST_ASSERT_TRUE_MESSAGE(response.find("85") != std::string::npos, response.c_str());
+  TEST_ASSERT_TRUE_MESSAGE(response.find("70") == std::string::npos, response.c_str());
+}
+
+void test_request_behind_long_poll_waits()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response = roundTrip(connection, request("GET", "/things/lamp/properties/on?wait=10", "HTTP/1.1") +
+                                                   request("GET", "/things/lamp/properties/on", "HTTP/1.1"));
+  TEST_ASSERT_TRUE_MESSAGE(response.empty(), response.c_str());
+
+  switchOn();
+  response = pump(connection);
+  TEST_ASSERT_EQUAL_MESSAGE(2, count(response, "HTTP/1.1 200"), response.c_str());
+}
+
+void test_event_stream()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::shared_ptr<ThingFakeConnection> connection = thing_fake_ethernet_connect(port);
+  std::string response =
+      roundTrip(connection, request("GET", "/things/lamp", "HTTP/1.1", "Accept: text/event-stream\r\n"));
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+  TEST_ASSERT_TRUE(response.find("Content-Type: text/event-stream\r\n") != std::string::npos);
+  TEST_ASSERT_TRUE(response.find("retry: 3000") != std::string::npos);
+  TEST_ASSERT_EQUAL(1, adapter->getHttpStats().parked);
+
+  TEST_ASSERT_TRUE(pump(connection).empty());
+
+  switchOn();
+  ThingDataValue value;
+  value.number = 85;
+  lamp->queueEvent("overheated", NUMBER, value);
+  response = pump(connection);
+  TEST_ASSERT_TRUE_MESSAGE(response.find("event: propertyStatus\ndata: {") != std::string::npos,
+                           response.c_str());
+  TEST_ASSERT_TRUE_MESSAGE(response.find("\"on\":true") != std::string::npos, response.c_str());
+  TEST_ASSERT_TRUE_MESSAGE(response.find("event: event\ndata: {\"overheated\"") != std::string::npos,
+                           response.c_str());
+  TEST_ASSERT_FALSE(connection->stopped);
+}
+
+void test_parked_slots_capped()
+{
+  adapter->addDevice(lamp);
+  adapter->begin();
+
+  std::vector<std::shared_ptr<ThingFakeConnection>> polls;
+  for (int i = 0; i < THING_HTTP_PARKED_SLOTS; i++)
+  {
+    polls.push_back(thing_fake_ethernet_connect(port));
+    roundTrip(polls.back(), request("GET", "/things/lamp/properties/on?wait=10", "HTTP/1.1"));
+  }
+  TEST_ASSERT_EQUAL(THING_HTTP_PARKED_SLOTS, adapter->getHttpStats().parked);
+
+  // the slot left over still serves ordinary requests, but not another wait
+  std::string response = get("/things/lamp/properties/on?wait=10");
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 503"), response.c_str());
+  response = get("/things/lamp/properties/on");
+  TEST_ASSERT_TRUE_MESSAGE(startsWith(response, "HTTP/1.1 200"), response.c_str());
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_device_added_before_begin);
+  RUN_TEST(test_device_added_after_begin);
+  RUN_TEST(test_unknown_device);
+  RUN_TEST(test_keep_alive_off);
+  RUN_TEST(test_pipelined_requests);
+  RUN_TEST(test_error_closes_pipeline);
+  RUN_TEST(test_http10_keep_alive);
+  RUN_TEST(test_connection_close);
+  RUN_TEST(test_keep_alive_max_requests);
+  RUN_TEST(test_property_long_poll);
+  RUN_TEST(test_property_long_poll_timeout);
+  RUN_TEST(test_property_long_poll_stale_etag);
+  RUN_TEST(test_event_long_poll);
+  RUN_TEST(test_request_behind_long_poll_waits);
+  RUN_TEST(test_event_stream);
+  RUN_TEST(test_parked_slots_capped);
+  return UNITY_END();
+}
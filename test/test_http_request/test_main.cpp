@@ -0,0 +1,221 @@
+/**
+ * test_main.cpp
+ *
+ * ThingHttpRequest on its own: requests that arrive in pieces, bodies
+ * framed by Content-Length, the statuses for requests it cannot take
+ * (400, 413, 431, 501), pipelined requests and keep-alive.
+ *
+ *   pio test -e native -f test_http_request -v
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <ThingHttpRequest.h>
+#include <unity.h>
+
+#include <string>
+
+static ThingHttpRequest *request = nullptr;
+
+// writes data into the request as the adapter does with a socket read
+static ThingHttpParseState feed(const std::string &data)
+{
+  size_t room;
+  char *space = request->space(&room);
+  size_t n = data.size() < room ? data.size() : room;
+  memcpy(space, data.data(), n);
+  return request->received(n);
+}
+
+void setUp()
+{
+  request = new ThingHttpRequest();
+}
+
+void tearDown()
+{
+  delete request;
+  request = nullptr;
+}
+
+void test_get_in_one_block()
+{
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE,
+                    feed("GET /things/lamp?wait=30 HTTP/1.1\r\n"
+                         "Host: lamp.local\r\n"
+                         "Accept: text/event-stream\r\n"
+                         "If-None-Match: \"1a\"\r\n"
+                         "\r\n"));
+  TEST_ASSERT_EQUAL_STRING("GET", request->method());
+  TEST_ASSERT_EQUAL_STRING("/things/lamp", request->uri());
+  TEST_ASSERT_EQUAL(12, request->uriLength());
+  TEST_ASSERT_EQUAL_STRING("wait=30", request->query());
+  TEST_ASSERT_EQUAL_STRING("lamp.local", request->host());
+  TEST_ASSERT_EQUAL_STRING("text/event-stream", request->accept());
+  TEST_ASSERT_EQUAL_STRING("\"1a\"", request->ifNoneMatch());
+  TEST_ASSERT_EQUAL(0, request->bodyLength());
+  TEST_ASSERT_EQUAL_STRING("", request->body());
+}
+
+void test_body_by_content_length()
+{
+  std::string head = "PUT /things/lamp/properties/on HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "content-length: 11\r\n"
+                     "\r\n";
+  TEST_ASSERT_EQUAL(THING_HTTP_HEAD, feed(head.substr(0, 20)));
+  TEST_ASSERT_TRUE(request->pending());
+  TEST_ASSERT_EQUAL(THING_HTTP_BODY, feed(head.substr(20)));
+  TEST_ASSERT_EQUAL(THING_HTTP_BODY, feed("{\"on\":"));
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE, feed("true}"));
+
+  TEST_ASSERT_EQUAL_STRING("PUT", request->method());
+  TEST_ASSERT_EQUAL_STRING("/things/lamp/properties/on", request->uri());
+  TEST_ASSERT_EQUAL(11, request->bodyLength());
+  TEST_ASSERT_EQUAL_STRING("{\"on\":true}", request->body());
+}
+
+void test_head_split_at_every_byte()
+{
+  std::string data = "POST /things/lamp/actions HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "Content-Length: 2\r\n"
+                     "\r\n"
+                     "{}";
+  ThingHttpParseState state = THING_HTTP_HEAD;
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    TEST_ASSERT_NOT_EQUAL(THING_HTTP_COMPLETE, state);
+    state = feed(data.substr(i, 1));
+  }
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE, state);
+  TEST_ASSERT_EQUAL_STRING("/things/lamp/actions", request->uri());
+  TEST_ASSERT_EQUAL_STRING("{}", request->body());
+}
+
+void test_empty_lines_before_request_line()
+{
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE, feed("\r\n\r\nGET / HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+  TEST_ASSERT_EQUAL_STRING("GET", request->method());
+  TEST_ASSERT_EQUAL_STRING("/", request->uri());
+}
+
+void test_bad_request_line()
+{
+  TEST_ASSERT_EQUAL(THING_HTTP_ERROR, feed("GET\r\nHost: localhost\r\n\r\n"));
+  TEST_ASSERT_EQUAL(400, request->errorStatus());
+}
+
+void test_bad_content_length()
+{
+  TEST_ASSERT_EQUAL(THING_HTTP_ERROR,
+                    feed("PUT / HTTP/1.1\r\nContent-Length: 12x\r\n\r\n"));
+  TEST_ASSERT_EQUAL(400, request->errorStatus());
+}
+
+void test_body_too_large()
+{
+  std::string head = "PUT / HTTP/1.1\r\nContent-Length: " +
+                     std::to_string(THING_HTTP_REQUEST_SIZE) + "\r\n\r\n";
+  TEST_ASSERT_EQUAL(THING_HTTP_ERROR, feed(head));
+  TEST_ASSERT_EQUAL(413, request->errorStatus());
+}
+
+void test_body_fills_buffer()
+{
+  std::string head = "PUT / HTTP/1.1\r\nContent-Length: ";
+  // the head with the digits, then exactly as many body bytes as fit
+  size_t bodyLength = THING_HTTP_REQUEST_SIZE - head.size() - 4;
+  bodyLength -= std::to_string(bodyLength).size();
+  head += std::to_string(bodyLength) + "\r\n\r\n";
+  TEST_ASSERT_EQUAL(THING_HTTP_REQUEST_SIZE, head.size() + bodyLength);
+
+  TEST_ASSERT_EQUAL(THING_HTTP_BODY, feed(head));
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE, feed(std::string(bodyLength, 'x')));
+  TEST_ASSERT_EQUAL(bodyLength, strlen(request->body()));
+}
+
+void test_head_too_large()
+{
+  std::string head = "GET / HTTP/1.1\r\nX-Padding: ";
+  head += std::string(THING_HTTP_REQUEST_SIZE, 'x');
+  TEST_ASSERT_EQUAL(THING_HTTP_ERROR, feed(head));
+  TEST_ASSERT_EQUAL(431, request->errorStatus());
+}
+
+void test_chunked_body_not_implemented()
+{
+  TEST_ASSERT_EQUAL(THING_HTTP_ERROR,
+                    feed("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"));
+  TEST_ASSERT_EQUAL(501, request->errorStatus());
+}
+
+void test_pipelined_next()
+{
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE,
+                    feed("PUT /a HTTP/1.1\r\nContent-Length: 2\r\n\r\n{}"
+                         "GET /b HTTP/1.1\r\n\r\n"
+                         "GET /c HT"));
+  TEST_ASSERT_EQUAL_STRING("/a", request->uri());
+  TEST_ASSERT_EQUAL_STRING("{}", request->body());
+
+  // the byte after the body was overwritten by its NUL and is restored
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE, request->next());
+  TEST_ASSERT_EQUAL_STRING("GET", request->method());
+  TEST_ASSERT_EQUAL_STRING("/b", request->uri());
+
+  TEST_ASSERT_EQUAL(THING_HTTP_HEAD, request->next());
+  TEST_ASSERT_TRUE(request->pending());
+  TEST_ASSERT_EQUAL(THING_HTTP_COMPLETE, feed("TP/1.1\r\n\r\n"));
+  TEST_ASSERT_EQUAL_STRING("/c", request->uri());
+
+  TEST_ASSERT_EQUAL(THING_HTTP_HEAD, request->next());
+  TEST_ASSERT_FALSE(request->pending());
+}
+
+void test_keep_alive_by_version()
+{
+  feed("GET / HTTP/1.1\r\n\r\n");
+  TEST_ASSERT_TRUE(request->http11());
+  TEST_ASSERT_TRUE(request->keepAlive());
+
+  request->reset();
+  feed("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+  TEST_ASSERT_FALSE(request->keepAlive());
+
+  request->reset();
+  feed("GET / HTTP/1.0\r\n\r\n");
+  TEST_ASSERT_FALSE(request->http11());
+  TEST_ASSERT_FALSE(request->keepAlive());
+
+  request->reset();
+  feed("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n");
+  TEST_ASSERT_FALSE(request->http11());
+  TEST_ASSERT_TRUE(request->keepAlive());
+
+  request->reset();
+  feed("GET / HTTP/1.0\r\nConnection: TE, keep-alive\r\n\r\n");
+  TEST_ASSERT_TRUE(request->keepAlive());
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_get_in_one_block);
+  RUN_TEST(test_body_by_content_length);
+  RUN_TEST(test_head_split_at_every_byte);
+  RUN_TEST(test_empty_lines_before_request_line);
+  RUN_TEST(test_bad_request_line);
+  RUN_TEST(test_bad_content_length);
+  RUN_TEST(test_body_too_large);
+  RUN_TEST(test_body_fills_buffer);
+  RUN_TEST(test_head_too_large);
+  RUN_TEST(test_chunked_body_not_implemented);
+  RUN_TEST(test_pipelined_next);
+  RUN_TEST(test_keep_alive_by_version);
+  return UNITY_END();
+}
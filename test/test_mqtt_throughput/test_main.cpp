@@ -0,0 +1,335 @@
+/**
+ * test_main.cpp
+ *
+ * Throughput benchmark of the MQTT publish path: BENCH_DEVICES devices
+ * with BENCH_PROPERTIES numeric properties each change every property
+ * BENCH_ROUNDS times through ThingProperty::setValue()/hasChanged(), the
+ * adapter's outbox and the esp-mqtt stand-in in test/native_fakes. Reports
+ * publishes per second, bytes per publish (topic and payload), heap
+ * allocations per publish and the p50/p99 latency from hasChanged() to the
+ * stand-in broker, for JSON, MessagePack and the compact mode. The publish
+ * path must not allocate: the test fails if a measured loop does.
+ *
+ *   pio test -e native -f test_mqtt_throughput -v
+ *
+ * The producer waits while the outbox is full, so every change is either
+ * published or coalesced with a newer one, never dropped.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <ESPWebThingAdapter.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#ifndef BENCH_DEVICES
+#define BENCH_DEVICES 8
+#endif
+
+#ifndef BENCH_PROPERTIES
+#define BENCH_PROPERTIES 16
+#endif
+
+#ifndef BENCH_ROUNDS
+#define BENCH_ROUNDS 500
+#endif
+
+// every heap allocation in the process, sampled around the measured loop:
+// operator new, and on glibc also malloc/calloc/realloc, which
+// DynamicJsonDocument and ThingIndex use directly. Sanitizer builds keep
+// their own malloc, so there only operator new is counted.
+static std::atomic<uint64_t> allocations{0};
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define BENCH_COUNTS_MALLOC 1
+
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *p, size_t size);
+  void __libc_free(void *p);
+
+  void *malloc(size_t size)
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t count, size_t size)
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+  }
+
+  void *realloc(void *p, size_t size)
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+  }
+
+  void free(void *p)
+  {
+    __libc_free(p);
+  }
+}
+
+// malloc() already counts
+#define BENCH_COUNT_NEW()
+#else
+#define BENCH_COUNTS_MALLOC 0
+#define BENCH_COUNT_NEW() allocations.fetch_add(1, std::memory_order_relaxed)
+#endif
+
+void *operator new(size_t size)
+{
+  BENCH_COUNT_NEW();
+  void *p = malloc(size > 0 ? size : 1);
+  if (p == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  BENCH_COUNT_NEW();
+  return malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+  return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static const char *deviceTypes[] = {"Sensor", nullptr};
+
+struct Bench
+{
+  std::vector<ThingDevice *> devices;
+  std::vector<ThingProperty *> properties;
+  std::vector<std::unique_ptr<String>> ids;
+  // property index by publish topic, the keys point into ThingProperty::topic
+  std::unordered_map<std::string_view, size_t> byTopic;
+  // thing_monotonic_us() of the latest hasChanged() per property
+  std::unique_ptr<std::atomic<int64_t>[]> changedUs;
+  std::vector<uint32_t> latenciesUs;
+  std::atomic<size_t> received{0};
+};
+
+static Bench *bench = nullptr;
+
+// runs on the outbox sender thread, must not allocate
+static void onPublish(void *context, const char *topic, const char *data, int len, int qos,
+                      int retain)
+{
+  (void)data;
+  (void)len;
+  (void)qos;
+  (void)retain;
+  Bench *b = (Bench *)context;
+  auto it = b->byTopic.find(std::string_view(topic));
+  if (it == b->byTopic.end())
+  {
+    return;
+  }
+
+  int64_t latency = thing_monotonic_us() - b->changedUs[it->second].load();
+  size_t i = b->received.fetch_add(1);
+  if (i < b->latenciesUs.size())
+  {
+    b->latenciesUs[i] = (uint32_t)latency;
+  }
+}
+
+static void startAdapter(ThingEncoding encoding, bool compact)
+{
+  bench = new Bench();
+  mqttAdapter = new ThingMQTTAdapter("bench", "localhost");
+  mqttAdapter->setmqttbroker_Credentials("bench", "bench");
+
+  for (int d = 0; d < BENCH_DEVICES; d++)
+  {
+    bench->ids.emplace_back(new String(String("dev") + d));
+    ThingDevice *device = new ThingDevice(bench->ids.back()->c_str(), "Benchmark device", deviceTypes);
+    for (int p = 0; p < BENCH_PROPERTIES; p++)
+    {
+      bench->ids.emplace_back(new String(String("value") + p));
+      ThingProperty *property = new ThingProperty(bench->ids.back()->c_str(), "benchmark value",
+                                                  NUMBER, nullptr, nullptr);
+      // every change is significant
+      property->setReportingPolicy(ThingReportingPolicy());
+      device->addProperty(property);
+      bench->properties.push_back(property);
+    }
+    mqttAdapter->addDevice(device);
+    bench->devices.push_back(device);
+  }
+  mqttAdapter->setEncoding(encoding);
+  mqttAdapter->setCompact(compact);
+
+  TEST_ASSERT_TRUE(mqttAdapter->begin());
+  // publishes the TDs, which are not part of the measurement
+  mqttAdapter->update();
+  while (mqttAdapter->getOutboxStats().depth > 0)
+  {
+    yield();
+  }
+
+  size_t count = bench->properties.size();
+  bench->changedUs.reset(new std::atomic<int64_t>[count]);
+  for (size_t i = 0; i < count; i++)
+  {
+    bench->changedUs[i] = 0;
+    bench->byTopic[std::string_view(bench->properties[i]->topic.c_str())] = i;
+  }
+  bench->latenciesUs.resize(count * BENCH_ROUNDS);
+  thing_fake_mqtt_set_hook(mqtt_client, onPublish, bench);
+}
+
+static void stopAdapter()
+{
+  thing_fake_mqtt_set_hook(mqtt_client, nullptr, nullptr);
+  // joins the outbox sender before its client goes away
+  delete mqttAdapter;
+  mqttAdapter = nullptr;
+  mqtt_outbox = nullptr;
+  esp_mqtt_client_destroy(mqtt_client);
+  mqtt_client = nullptr;
+
+  for (ThingDevice *device : bench->devices)
+  {
+    delete device;
+  }
+  for (ThingProperty *property : bench->properties)
+  {
+    delete property;
+  }
+  delete bench;
+  bench = nullptr;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, unsigned p)
+{
+  if (sorted.empty())
+  {
+    return 0;
+  }
+  size_t i = sorted.size() * p / 100;
+  return sorted[i < sorted.size() ? i : sorted.size() - 1];
+}
+
+static void runBenchmark(const char *label, ThingEncoding encoding, bool compact)
+{
+  startAdapter(encoding, compact);
+  thing_fake_mqtt_reset_stats(mqtt_client);
+  ThingOutboxStats before = mqttAdapter->getOutboxStats();
+  size_t count = bench->properties.size();
+
+  uint64_t allocationsBefore = allocations.load();
+  int64_t startUs = thing_monotonic_us();
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      while (mqttAdapter->getOutboxStats().depth >= THING_OUTBOX_SLOTS)
+      {
+        yield();
+      }
+
+      ThingDataValue value;
+      value.number = round + i * 0.001;
+      bench->changedUs[i] = thing_monotonic_us();
+      bench->properties[i]->setValue(value);
+      bench->properties[i]->hasChanged();
+    }
+  }
+  while (mqttAdapter->getOutboxStats().depth > 0)
+  {
+    yield();
+  }
+  int64_t elapsedUs = thing_monotonic_us() - startUs;
+  uint64_t allocated = allocations.load() - allocationsBefore;
+
+  thing_fake_mqtt_stats broker = thing_fake_mqtt_get_stats(mqtt_client);
+  ThingOutboxStats after = mqttAdapter->getOutboxStats();
+  uint32_t changes = (uint32_t)(count * BENCH_ROUNDS);
+  uint32_t coalesced = after.coalesced - before.coalesced;
+
+  size_t samples = std::min(bench->received.load(), bench->latenciesUs.size());
+  std::vector<uint32_t> sorted(bench->latenciesUs.begin(), bench->latenciesUs.begin() + samples);
+  std::sort(sorted.begin(), sorted.end());
+
+  double published = broker.published > 0 ? broker.published : 1;
+  char report[256];
+  snprintf(report, sizeof(report),
+           "%s: %u devices x %u properties, %u changes -> %u publishes (%u coalesced) in %.1f ms: "
+           "%.0f publishes/s, %.1f bytes/publish (topic %.1f), %.3f allocations/publish, "
+           "latency p50 %u us, p99 %u us%s",
+           label, BENCH_DEVICES, BENCH_PROPERTIES, changes, broker.published, coalesced,
+           elapsedUs / 1000.0, broker.published * 1e6 / (elapsedUs > 0 ? elapsedUs : 1),
+           (broker.topicBytes + broker.payloadBytes) / published, broker.topicBytes / published,
+           allocated / published, percentile(sorted, 50), percentile(sorted, 99),
+           BENCH_COUNTS_MALLOC ? "" : " (operator new only)");
+  TEST_MESSAGE(report);
+
+  TEST_ASSERT_EQUAL_UINT32(0, after.dropped - before.dropped);
+  TEST_ASSERT_EQUAL_UINT32(changes, broker.published + coalesced);
+  TEST_ASSERT_TRUE_MESSAGE(allocated == 0, "the publish path allocated");
+  stopAdapter();
+}
+
+void setUp()
+{
+  Serial.quiet = true;
+}
+
+void tearDown()
+{
+}
+
+void test_throughput_json()
+{
+  runBenchmark("json", THING_ENCODING_JSON, false);
+}
+
+void test_throughput_msgpack()
+{
+  runBenchmark("msgpack", THING_ENCODING_MSGPACK, false);
+}
+
+void test_throughput_compact()
+{
+  runBenchmark("compact json", THING_ENCODING_JSON, true);
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_throughput_json);
+  RUN_TEST(test_throughput_msgpack);
+  RUN_TEST(test_throughput_compact);
+  return UNITY_END();
+}